@@ -0,0 +1,140 @@
+#include "batch.hpp"
+#include "theorem_prover.hpp"
+#include "deadline.hpp"
+
+#include <string>
+#include <sstream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+// Error messages quote the formula, which may hold any character.
+static void write_escaped(std::ostream &out, const std::string &text)
+{
+    for (const auto c : text) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out << ' ';
+        } else {
+            out << c;
+        }
+    }
+}
+
+// The input and output of the batch, shared by the workers. The input is read one line at a time, so
+// a batch never holds more formulas than there are workers, plus the results held back for ordering.
+class BatchQueue
+{
+public:
+    BatchQueue(std::istream &in, std::ostream &out, BatchOrder order)
+        : m_in(in)
+        , m_out(out)
+        , m_order(order)
+    {
+
+    }
+
+    // Takes the next formula along with its sequence number and line number, if there are any left.
+    bool next(std::string &formula, std::size_t &sequence, std::size_t &line)
+    {
+        std::lock_guard lock(m_in_mutex);
+        while (std::getline(m_in, formula)) {
+            m_line++;
+            if (!formula.empty()) {
+                sequence = m_sequence++;
+                line = m_line;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void write(std::size_t sequence, std::string &&result, bool failed)
+    {
+        std::lock_guard lock(m_out_mutex);
+        m_failed += failed;
+        if (m_order == BatchOrder::COMPLETION) {
+            m_out << result << std::endl;
+            return;
+        }
+        m_pending.emplace(sequence, std::move(result));
+        for (auto it = m_pending.begin(); it != m_pending.end() && it->first == m_written; it = m_pending.erase(it)) {
+            m_out << it->second << std::endl;
+            m_written++;
+        }
+    }
+
+    std::size_t failed() const { return m_failed; }
+
+private:
+    std::mutex m_in_mutex;
+    std::istream &m_in;
+    std::size_t m_line = 0;
+    std::size_t m_sequence = 0;
+
+    std::mutex m_out_mutex;
+    std::ostream &m_out;
+    BatchOrder m_order;
+    // Results that finished before some of the formulas preceding them, by sequence number.
+    std::map<std::size_t, std::string> m_pending;
+    std::size_t m_written = 0;
+    std::size_t m_failed = 0;
+};
+
+ProofOutcome write_proof_result(std::ostream &out, const TheoremProver &prover, const std::string &formula, bool with_stats)
+{
+    ProofStats stats;
+    auto outcome = ProofOutcome::ERROR;
+    out << "\"result\":";
+    const auto start = std::chrono::steady_clock::now();
+    try {
+        outcome = prover.is_theorem(formula, with_stats ? &stats : nullptr) ? ProofOutcome::THEOREM : ProofOutcome::NOT_THEOREM;
+        out << (outcome == ProofOutcome::THEOREM ? "\"theorem\"" : "\"not_theorem\"");
+    } catch (const TimeLimitExceeded &) {
+        outcome = ProofOutcome::TIMEOUT;
+        out << "\"timeout\"";
+    } catch (const MemoryLimitExceeded &) {
+        outcome = ProofOutcome::OUT_OF_MEMORY;
+        out << "\"out_of_memory\"";
+    } catch (const std::exception &error) {
+        out << "\"error\",\"error\":\"";
+        write_escaped(out, error.what());
+        out << "\"";
+    }
+    out << ",\"time_ns\":" << std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    if (with_stats && (outcome == ProofOutcome::THEOREM || outcome == ProofOutcome::NOT_THEOREM)) {
+        out << ",\"stats\":";
+        write_json(out, stats);
+    }
+    return outcome;
+}
+
+static void run_worker(BatchQueue &queue, const BatchOptions &options)
+{
+    const TheoremProver prover(true, options.memory_limit, options.time_limit, options.cache);
+    std::string formula;
+    std::size_t sequence, line;
+    while (queue.next(formula, sequence, line)) {
+        std::ostringstream result;
+        result << "{\"line\":" << line << ",";
+        const auto outcome = write_proof_result(result, prover, formula, options.stats);
+        result << "}";
+        queue.write(sequence, std::move(result).str(), outcome != ProofOutcome::THEOREM && outcome != ProofOutcome::NOT_THEOREM);
+    }
+}
+
+std::size_t prove_batch(std::istream &in, std::ostream &out, const BatchOptions &options)
+{
+    const auto jobs = options.jobs > 0 ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+    BatchQueue queue(in, out, options.order);
+    {
+        std::vector<std::jthread> workers;
+        for (unsigned i = 0; i < jobs; i++) {
+            workers.emplace_back(run_worker, std::ref(queue), std::cref(options));
+        }
+    }
+    return queue.failed();
+}
@@ -0,0 +1,56 @@
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+#include <istream>
+#include <ostream>
+#include <string>
+#include <chrono>
+#include <cstddef>
+
+class TheoremProver;
+class ResultCache;
+
+// How a single proof ended.
+enum class ProofOutcome
+{
+    THEOREM,
+    NOT_THEOREM,
+    TIMEOUT,
+    OUT_OF_MEMORY,
+    ERROR
+};
+
+// Proves the formula and writes its result ("theorem", "not_theorem", "timeout", "out_of_memory" or
+// "error" with a message), its wall time and optionally its statistics as fields of a JSON object,
+// without the braces. Never throws for a failed proof, only reports it.
+ProofOutcome write_proof_result(std::ostream &out, const TheoremProver &prover, const std::string &formula, bool with_stats);
+
+// Order the results of a batch are written in.
+enum class BatchOrder
+{
+    // The order of the formulas in the input, holding back results that finish early.
+    INPUT,
+    // The order the proofs finish in, writing every result as soon as it is known.
+    COMPLETION
+};
+
+struct BatchOptions
+{
+    // Number of proofs run in parallel, 0 for one per hardware thread.
+    unsigned jobs = 0;
+    BatchOrder order = BatchOrder::INPUT;
+    // Limits on every single proof, 0 for none.
+    std::size_t memory_limit = 0;
+    std::chrono::milliseconds time_limit{};
+    // Adds the statistics of every proof to its result.
+    bool stats = false;
+    // Shared by all the workers, if given.
+    ResultCache *cache = nullptr;
+};
+
+// Proves every non-empty line of the input as a formula, on a pool of worker threads, and writes a line
+// of JSON for each: its line number followed by its result. A formula that fails is reported as such
+// without stopping the others. Returns the number of formulas that failed.
+std::size_t prove_batch(std::istream &in, std::ostream &out, const BatchOptions &options);
+
+#endif // BATCH_HPP
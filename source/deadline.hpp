@@ -0,0 +1,50 @@
+#ifndef DEADLINE_HPP
+#define DEADLINE_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+
+// Thrown when a proof runs past its time limit.
+class TimeLimitExceeded : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// The time by which the proof running on this thread has to finish, if it has a limit.
+inline thread_local std::chrono::steady_clock::time_point active_deadline = std::chrono::steady_clock::time_point::max();
+
+// Makes the given time limit (0 for none) the active deadline for its lifetime.
+class DeadlineScope
+{
+public:
+    explicit DeadlineScope(std::chrono::milliseconds time_limit) : m_previous(active_deadline)
+    {
+        if (time_limit.count() > 0) {
+            active_deadline = std::chrono::steady_clock::now() + time_limit;
+        }
+    }
+    ~DeadlineScope() { active_deadline = m_previous; }
+
+    DeadlineScope(const DeadlineScope &) = delete;
+    DeadlineScope &operator=(const DeadlineScope &) = delete;
+
+private:
+    std::chrono::steady_clock::time_point m_previous;
+};
+
+// Throws TimeLimitExceeded once the active deadline has passed. Called from the inner loops of the
+// proof, so it only reads the clock on every 64th call.
+inline void check_deadline()
+{
+    static thread_local std::uint32_t calls = 0;
+    if (active_deadline == std::chrono::steady_clock::time_point::max() || (++calls & 63) != 0) {
+        return;
+    }
+    if (std::chrono::steady_clock::now() > active_deadline) {
+        throw TimeLimitExceeded("The proof ran out of time");
+    }
+}
+
+#endif // DEADLINE_HPP
@@ -0,0 +1,196 @@
+#include "fourier_motzkin.hpp"
+#include "fraction.hpp"
+
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <functional>
+#include <iostream>
+
+// Microbenchmarks of Fraction arithmetic and of the Fourier-Motzkin kernel. The inputs are generated
+// from a fixed seed, so every run measures the same work. Every benchmark is reported as a line of
+// JSON, with the time per operation in nanoseconds.
+//
+// Usage: fm_bench [constraints] [variables] [seed]
+
+using System = std::vector<Constraint<Fraction>>;
+
+// Keeps the results of the measured work observable, so it can't be optimized away.
+static volatile std::size_t sink;
+
+struct Measurement
+{
+    std::size_t iterations;
+    double ns_per_op;
+};
+
+// Runs the batch, which does ops_per_batch operations, until it took at least the minimal time, and
+// reports the mean time per operation. The setup of every batch is left out of the measured time.
+static Measurement measure(const std::function<void()> &setup, const std::function<void()> &batch, std::size_t ops_per_batch)
+{
+    static constexpr std::chrono::milliseconds min_time(200);
+
+    std::chrono::steady_clock::duration elapsed{};
+    std::size_t batches = 0;
+    while (elapsed < min_time) {
+        setup();
+        const auto start = std::chrono::steady_clock::now();
+        batch();
+        elapsed += std::chrono::steady_clock::now() - start;
+        batches++;
+    }
+    const auto iterations = batches * ops_per_batch;
+    return Measurement{iterations, std::chrono::duration<double, std::nano>(elapsed).count() / iterations};
+}
+
+static void report(const std::string &benchmark, const std::string &parameters, const Measurement &measurement)
+{
+    std::cout << "{\"benchmark\":\"" << benchmark << "\"" << parameters
+              << ",\"iterations\":" << measurement.iterations << ",\"ns_per_op\":" << measurement.ns_per_op << "}" << std::endl;
+}
+
+static std::vector<Fraction> random_fractions(std::mt19937 &random, std::size_t count)
+{
+    std::uniform_int_distribution numerator(-1000, 1000), denominator(1, 1000);
+    std::vector<Fraction> fractions;
+    fractions.reserve(count);
+    for (std::size_t i = 0; i < count; i++) {
+        fractions.emplace_back(numerator(random), denominator(random));
+    }
+    return fractions;
+}
+
+static void bench_fractions(std::mt19937 &random)
+{
+    static constexpr std::size_t count = 4096;
+    const auto left = random_fractions(random, count), right = random_fractions(random, count);
+    // Divisors must be non-zero.
+    auto divisors = right;
+    for (auto &divisor : divisors) {
+        if (divisor == Fraction{}) {
+            divisor = Fraction(1);
+        }
+    }
+
+    const auto bench_operation = [&](const std::string &name, const std::vector<Fraction> &operands, const std::function<Fraction(const Fraction&, const Fraction&)> &operation) {
+        report("fraction_" + name, "", measure([] {}, [&] {
+            std::size_t checksum = 0;
+            for (std::size_t i = 0; i < count; i++) {
+                checksum += operation(left[i], operands[i]).get_numerator();
+            }
+            sink = checksum;
+        }, count));
+    };
+    bench_operation("add", right, [](const Fraction &l, const Fraction &r) { return l + r; });
+    bench_operation("subtract", right, [](const Fraction &l, const Fraction &r) { return l - r; });
+    bench_operation("multiply", right, [](const Fraction &l, const Fraction &r) { return l * r; });
+    bench_operation("divide", divisors, [](const Fraction &l, const Fraction &r) { return l / r; });
+
+    report("fraction_compare", "", measure([] {}, [&] {
+        std::size_t checksum = 0;
+        for (std::size_t i = 0; i < count; i++) {
+            checksum += left[i] < right[i];
+        }
+        sink = checksum;
+    }, count));
+}
+
+// Generates a system in which every constraint has the eliminated variable 0 and, if dense, all the
+// other variables, or if sparse, a single other one. The coefficients are small, so that a single
+// elimination step can't overflow them. With an equality, the first constraint is one.
+static System generate_system(std::mt19937 &random, std::size_t constraints, std::size_t variables, bool dense, bool with_equality)
+{
+    std::uniform_int_distribution coefficient(1, 3), sign(0, 1), constant(-10, 10);
+    std::uniform_int_distribution<std::size_t> other_variable(1, variables - 1);
+    System system;
+    for (std::size_t i = 0; i < constraints; i++) {
+        std::vector<Fraction> lhs(variables);
+        // Alternating signs split the inequalities evenly between upper and lower bounds on variable 0.
+        lhs[0] = Fraction(i % 2 == 0 ? coefficient(random) : -coefficient(random));
+        if (dense) {
+            for (std::size_t k = 1; k < variables; k++) {
+                lhs[k] = Fraction(sign(random) ? coefficient(random) : -coefficient(random));
+            }
+        } else if (variables > 1) {
+            lhs[other_variable(random)] = Fraction(sign(random) ? coefficient(random) : -coefficient(random));
+        }
+        const auto relation = with_equality && i == 0 ? Constraint<Fraction>::Relation::EQ : Constraint<Fraction>::Relation::LT;
+        system.emplace_back(lhs, relation, Fraction(constant(random)));
+    }
+    return system;
+}
+
+// Eliminates variable 0 from a batch of copies of the system - by the equality if there is one,
+// or else by combining all pairs of its upper and lower bounds.
+static void bench_elimination(std::mt19937 &random, std::size_t constraints, std::size_t variables, bool dense, bool with_equality)
+{
+    static constexpr std::size_t batch_size = 16;
+    const auto system = generate_system(random, constraints, variables, dense, with_equality);
+    std::vector<ConstraintConjuction<Fraction>> copies;
+    const auto setup = [&] {
+        copies.assign(batch_size, ConstraintConjuction<Fraction>(system));
+    };
+    const auto batch = [&] {
+        std::size_t checksum = 0;
+        for (auto &copy : copies) {
+            checksum += copy.eliminate_variable(0).generated_rows;
+        }
+        sink = checksum;
+    };
+
+    const auto parameters = std::string(",\"density\":\"") + (dense ? "dense" : "sparse") + "\",\"constraints\":" + std::to_string(constraints) + ",\"variables\":" + std::to_string(variables);
+    report(with_equality ? "eliminate_by_equality" : "eliminate_by_inequality", parameters, measure(setup, batch, batch_size));
+}
+
+// Generates a chain x0 < x1 < ... of differences, plus random bounds on single variables. All the
+// coefficients stay 1 or -1 through every elimination, so deciding the whole system can't overflow.
+static System generate_chain(std::mt19937 &random, std::size_t constraints, std::size_t variables)
+{
+    std::uniform_int_distribution<std::size_t> variable(0, variables - 1);
+    std::uniform_int_distribution constant(-10, 10), sign(0, 1);
+    System system;
+    for (std::size_t i = 0; i + 1 < variables && system.size() < constraints; i++) {
+        std::vector<Fraction> lhs(variables);
+        lhs[i] = Fraction(1);
+        lhs[i + 1] = Fraction(-1);
+        system.emplace_back(lhs, Constraint<Fraction>::Relation::LT, Fraction(constant(random)));
+    }
+    while (system.size() < constraints) {
+        std::vector<Fraction> lhs(variables);
+        lhs[variable(random)] = Fraction(1);
+        const auto relation = sign(random) ? Constraint<Fraction>::Relation::LT : Constraint<Fraction>::Relation::GT;
+        system.emplace_back(lhs, relation, Fraction(constant(random)));
+    }
+    return system;
+}
+
+static void bench_satisfiability(std::mt19937 &random, std::size_t constraints, std::size_t variables)
+{
+    const ConstraintConjuction<Fraction> conjuction(generate_chain(random, constraints, variables));
+    const auto parameters = ",\"constraints\":" + std::to_string(constraints) + ",\"variables\":" + std::to_string(variables);
+    report("is_satisfiable", parameters, measure([] {}, [&] {
+        sink = conjuction.is_satisfiable();
+    }, 1));
+}
+
+int main(int argc, char *argv[])
+{
+    const std::size_t constraints = argc > 1 ? std::stoul(argv[1]) : 64;
+    const std::size_t variables = argc > 2 ? std::stoul(argv[2]) : 8;
+    const unsigned seed = argc > 3 ? std::stoul(argv[3]) : 42;
+    if (constraints < 2 || variables < 2) {
+        std::cerr << "At least 2 constraints and 2 variables are needed" << std::endl;
+        return 1;
+    }
+
+    std::mt19937 random(seed);
+    bench_fractions(random);
+    for (const auto dense : {false, true}) {
+        bench_elimination(random, constraints, variables, dense, true);
+        bench_elimination(random, constraints, variables, dense, false);
+    }
+    bench_satisfiability(random, constraints, variables);
+
+    return 0;
+}
@@ -0,0 +1,239 @@
+#include "theorem_prover.hpp"
+#include "problem_generator.hpp"
+
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <filesystem>
+#include <algorithm>
+#include <stdexcept>
+#include <optional>
+
+// Proves every problem of a corpus, reporting its wall time and peak memory as a line of JSON, and
+// compares them against a stored baseline. Exits with 1 if any problem regressed by more than the
+// threshold, and with 2 if any problem got a result other than the expected one, so it can gate a build.
+//
+// Usage: fm_corpus <corpus> [--baseline <file>] [--save-baseline <file>] [--threshold <ratio>] [--repetitions <n>]
+//
+// Every line of the corpus is either "<family> <size> [seed]" for a generated problem, "file <path>"
+// for a problem read from a file, relative to the corpus, or "formula <theorem|not_theorem> <formula>"
+// for a problem given inline along with its expected result. Empty lines and lines starting with # are
+// skipped.
+
+struct Problem
+{
+    std::string name;
+    std::string formula;
+    std::optional<bool> expected;
+};
+
+struct Result
+{
+    std::chrono::nanoseconds wall_time;
+    std::size_t peak_bytes;
+};
+
+static std::vector<Problem> read_corpus(const std::filesystem::path &path)
+{
+    std::ifstream in(path);
+    if (!in) {
+        throw std::runtime_error("Could not read the corpus \"" + path.string() + "\"");
+    }
+
+    std::vector<Problem> problems;
+    std::string line;
+    for (std::size_t line_number = 1; std::getline(in, line); line_number++) {
+        std::istringstream fields(line);
+        std::string kind;
+        if (!(fields >> kind) || kind[0] == '#') {
+            continue;
+        }
+
+        if (kind == "file") {
+            std::string file;
+            fields >> file;
+            std::ifstream problem_in(path.parent_path() / file);
+            std::string formula;
+            if (!std::getline(problem_in, formula)) {
+                throw std::runtime_error("Could not read the problem \"" + file + "\"");
+            }
+            problems.push_back(Problem{file, formula, std::nullopt});
+        } else if (kind == "formula") {
+            std::string expected, formula;
+            fields >> expected;
+            std::getline(fields >> std::ws, formula);
+            if ((expected != "theorem" && expected != "not_theorem") || formula.empty()) {
+                throw std::runtime_error("Expected \"formula <theorem|not_theorem> <formula>\" on line " + std::to_string(line_number));
+            }
+            problems.push_back(Problem{path.stem().string() + ":" + std::to_string(line_number), formula, expected == "theorem"});
+        } else {
+            unsigned size = 0, seed = 0;
+            if (!(fields >> size)) {
+                throw std::runtime_error("Missing the size of a \"" + kind + "\" problem");
+            }
+            fields >> seed;
+            problems.push_back(Problem{kind + "/" + std::to_string(size) + "/" + std::to_string(seed), generate_problem(kind, size, seed), std::nullopt});
+        }
+    }
+    return problems;
+}
+
+// Every line of a baseline is "<problem> <wall time in ns> <peak bytes>".
+static std::map<std::string, Result> read_baseline(const std::string &path)
+{
+    std::ifstream in(path);
+    if (!in) {
+        throw std::runtime_error("Could not read the baseline \"" + path + "\"");
+    }
+
+    std::map<std::string, Result> baseline;
+    std::string name;
+    long long wall_time;
+    std::size_t peak_bytes;
+    while (in >> name >> wall_time >> peak_bytes) {
+        baseline[name] = Result{std::chrono::nanoseconds(wall_time), peak_bytes};
+    }
+    return baseline;
+}
+
+static void save_baseline(const std::string &path, const std::vector<Problem> &problems, const std::vector<Result> &results)
+{
+    std::ofstream out(path);
+    for (std::size_t i = 0; i < problems.size(); i++) {
+        out << problems[i].name << " " << results[i].wall_time.count() << " " << results[i].peak_bytes << "\n";
+    }
+    if (!out) {
+        throw std::runtime_error("Could not write the baseline \"" + path + "\"");
+    }
+}
+
+// Times below a millisecond are mostly noise, so they never count as a regression.
+static bool is_regression(const Result &result, const Result &baseline, double threshold)
+{
+    static constexpr std::chrono::milliseconds noise(1);
+
+    const auto slower = result.wall_time > baseline.wall_time * (1 + threshold) && result.wall_time - baseline.wall_time > noise;
+    const auto larger = result.peak_bytes > baseline.peak_bytes * (1 + threshold);
+    return slower || larger;
+}
+
+// Names come from the corpus, so they are escaped to keep every output line valid JSON.
+static void write_escaped(std::ostream &out, const std::string &text)
+{
+    for (const auto c : text) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out << ' ';
+        } else {
+            out << c;
+        }
+    }
+}
+
+static constexpr const char *usage = "Usage: fm_corpus <corpus> [--baseline <file>] [--save-baseline <file>] [--threshold <ratio>] [--repetitions <n>]";
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        std::cerr << usage << std::endl;
+        return 2;
+    }
+
+    std::string baseline_file, save_file;
+    double threshold = 0.25;
+    unsigned repetitions = 3;
+    for (int i = 2; i < argc; i += 2) {
+        const std::string option = argv[i];
+        if (i + 1 == argc) {
+            std::cerr << "Missing the value of the option \"" << option << "\"" << std::endl << usage << std::endl;
+            return 2;
+        }
+        if (option == "--baseline") {
+            baseline_file = argv[i + 1];
+        } else if (option == "--save-baseline") {
+            save_file = argv[i + 1];
+        } else if (option == "--threshold") {
+            threshold = std::stod(argv[i + 1]);
+        } else if (option == "--repetitions") {
+            repetitions = std::max(1ul, std::stoul(argv[i + 1]));
+        } else {
+            std::cerr << "Unknown option \"" << option << "\"" << std::endl << usage << std::endl;
+            return 2;
+        }
+    }
+
+    std::vector<Problem> problems;
+    std::map<std::string, Result> baseline;
+    try {
+        problems = read_corpus(argv[1]);
+        if (!baseline_file.empty()) {
+            baseline = read_baseline(baseline_file);
+        }
+    } catch (const std::exception &error) {
+        std::cerr << error.what() << std::endl;
+        return 2;
+    }
+
+    // The fastest of the repetitions is the least disturbed by the rest of the machine. The peak
+    // memory is the same in every one of them.
+    const TheoremProver prover;
+    std::vector<Result> results;
+    std::size_t regressions = 0, wrong_results = 0;
+    for (const auto &problem : problems) {
+        bool is_theorem = false;
+        Result result{std::chrono::nanoseconds::max(), 0};
+        try {
+            for (unsigned i = 0; i < repetitions; i++) {
+                ProofStats stats;
+                const auto start = std::chrono::steady_clock::now();
+                is_theorem = prover.is_theorem(problem.formula, &stats);
+                result.wall_time = std::min(result.wall_time, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start));
+                result.peak_bytes = stats.memory.total_peak;
+            }
+        } catch (const std::exception &error) {
+            std::cerr << problem.name << ": " << error.what() << std::endl;
+            return 2;
+        }
+        results.push_back(result);
+
+        std::cout << "{\"problem\":\"";
+        write_escaped(std::cout, problem.name);
+        std::cout << "\",\"theorem\":" << (is_theorem ? "true" : "false")
+                  << ",\"wall_ns\":" << result.wall_time.count() << ",\"peak_bytes\":" << result.peak_bytes;
+        if (const auto it = baseline.find(problem.name); it != baseline.end()) {
+            const auto regressed = is_regression(result, it->second, threshold);
+            regressions += regressed;
+            std::cout << ",\"baseline_wall_ns\":" << it->second.wall_time.count() << ",\"baseline_peak_bytes\":" << it->second.peak_bytes
+                      << ",\"regressed\":" << (regressed ? "true" : "false");
+        }
+        if (problem.expected) {
+            wrong_results += *problem.expected != is_theorem;
+            std::cout << ",\"expected\":" << (*problem.expected ? "true" : "false");
+        }
+        std::cout << "}" << std::endl;
+    }
+
+    if (!save_file.empty()) {
+        try {
+            save_baseline(save_file, problems, results);
+        } catch (const std::exception &error) {
+            std::cerr << error.what() << std::endl;
+            return 2;
+        }
+    }
+    if (wrong_results > 0) {
+        std::cerr << wrong_results << " problem(s) got a result other than the expected one" << std::endl;
+        return 2;
+    }
+    if (regressions > 0) {
+        std::cerr << regressions << " problem(s) regressed by more than " << threshold * 100 << "% against the baseline" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
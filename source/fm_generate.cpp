@@ -0,0 +1,29 @@
+#include "problem_generator.hpp"
+
+#include <string>
+#include <iostream>
+#include <stdexcept>
+
+// Writes a generated problem to the standard output, in the format the prover reads.
+//
+// Usage: fm_generate <family> <size> [seed]
+int main(int argc, char *argv[])
+{
+    if (argc < 3) {
+        std::cerr << "Usage: fm_generate <family> <size> [seed]" << std::endl << "Families:";
+        for (const auto &family : problem_families()) {
+            std::cerr << " " << family;
+        }
+        std::cerr << std::endl;
+        return 1;
+    }
+
+    try {
+        std::cout << generate_problem(argv[1], std::stoul(argv[2]), argc > 3 ? std::stoul(argv[3]) : 0) << std::endl;
+    } catch (const std::invalid_argument &error) {
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
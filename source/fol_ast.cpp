@@ -0,0 +1,303 @@
+#include "fol_ast.hpp"
+#include "deadline.hpp"
+
+#include <functional>
+#include <algorithm>
+
+LinearTerm::LinearTerm(const Fraction &coef, SymbolId symbol)
+{
+    if (coef != Fraction{}) {
+        coefs.push_back({symbol, coef});
+    }
+}
+
+Fraction LinearTerm::coefficient_of(SymbolId symbol) const
+{
+    const auto it = std::lower_bound(coefs.cbegin(), coefs.cend(), symbol, [](const auto &coef, SymbolId symbol) {
+        return coef.first < symbol;
+    });
+    return it != coefs.cend() && it->first == symbol ? it->second : Fraction{};
+}
+
+LinearTerm LinearTerm::operator+(const LinearTerm &other) const
+{
+    // Merges the sorted coefficients, dropping the variables that cancel out.
+    LinearTerm result(constant + other.constant);
+    result.coefs.reserve(coefs.size() + other.coefs.size());
+    auto l = coefs.cbegin(), r = other.coefs.cbegin();
+    while (l != coefs.cend() || r != other.coefs.cend()) {
+        if (r == other.coefs.cend() || (l != coefs.cend() && l->first < r->first)) {
+            result.coefs.push_back(*l++);
+        } else if (l == coefs.cend() || r->first < l->first) {
+            result.coefs.push_back(*r++);
+        } else {
+            if (const auto coef = l->second + r->second; coef != Fraction{}) {
+                result.coefs.push_back({l->first, coef});
+            }
+            l++;
+            r++;
+        }
+    }
+    return result;
+}
+
+LinearTerm LinearTerm::operator-(const LinearTerm &other) const
+{
+    return *this + other * Fraction(-1);
+}
+
+LinearTerm LinearTerm::operator*(const Fraction &factor) const
+{
+    if (factor == Fraction{}) {
+        return LinearTerm();
+    }
+    LinearTerm result(constant * factor);
+    result.coefs.reserve(coefs.size());
+    for (const auto &[symbol, coef] : coefs) {
+        result.coefs.push_back({symbol, coef * factor});
+    }
+    return result;
+}
+
+bool canonicalize(LinearTerm &term)
+{
+    const auto leading = term.coefs.empty() ? term.constant : term.coefs.front().second;
+    if (leading == Fraction{}) {
+        return false;
+    }
+    term = term * (Fraction(1) / leading);
+    return leading < Fraction{};
+}
+
+static std::size_t combine(std::size_t seed, std::size_t value)
+{
+    return seed ^ (value + 0x9e3779b97f4a7c15 + (seed << 6) + (seed >> 2));
+}
+
+static std::size_t hash_of(const Fraction &fraction)
+{
+    return combine(std::hash<int>{}(fraction.get_numerator()), std::hash<int>{}(fraction.get_denominator()));
+}
+
+static std::size_t hash_of(SymbolId symbol)
+{
+    return std::hash<SymbolId>{}(symbol);
+}
+
+template <typename Node>
+static std::size_t hash_of(NodeRef<Node> child)
+{
+    return std::hash<std::uint32_t>{}(child.index());
+}
+
+static std::size_t hash_of(std::span<const FormulaRef> operands)
+{
+    std::size_t hash = operands.size();
+    for (const auto &operand : operands) {
+        hash = combine(hash, hash_of(operand));
+    }
+    return hash;
+}
+
+static std::size_t hash_of(const LinearTerm &term)
+{
+    std::size_t hash = hash_of(term.constant);
+    for (const auto &[symbol, coef] : term.coefs) {
+        hash = combine(hash, combine(hash_of(symbol), hash_of(coef)));
+    }
+    return hash;
+}
+
+static std::size_t hash_of(const Atom &atom)
+{
+    return combine(atom.index(), std::visit(
+        [](const auto &node) {
+            return hash_of(node.term);
+        }, atom
+    ));
+}
+
+static std::size_t hash_of(const Formula &formula)
+{
+    return combine(formula.index(), std::visit(
+        overloaded{
+            [](const AtomWrapper &node) {
+                return hash_of(node.atom);
+            },
+            [](const True &node) {
+                return std::size_t{0};
+            },
+            [](const False &node) {
+                return std::size_t{0};
+            },
+            [](const Negation &node) {
+                return hash_of(node.operand);
+            },
+            [](const UniversalQuantification &node) {
+                return combine(hash_of(node.var_symbol), hash_of(node.formula));
+            },
+            [](const ExistentialQuantification &node) {
+                return combine(hash_of(node.var_symbol), hash_of(node.formula));
+            },
+            [](const Conjuction &node) {
+                return hash_of(node.operands);
+            },
+            [](const Disjunction &node) {
+                return hash_of(node.operands);
+            },
+            [](const auto &node) {
+                return combine(hash_of(node.left), hash_of(node.right));
+            }
+        }, formula
+    ));
+}
+
+// Spreads a hash over all of its bits before it is masked into a table slot. Hashes of children are
+// their consecutive indices, which would otherwise pile up in long runs of neighbouring slots.
+static std::size_t slot_of(std::size_t hash, std::size_t mask)
+{
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccd;
+    hash ^= hash >> 33;
+    return hash & mask;
+}
+
+// Nodes derived from a variant are compared as their variant.
+template <typename Node>
+static bool equal_nodes(const Node &left, const Node &right)
+{
+    if constexpr (requires { typename Node::variant; }) {
+        return static_cast<const typename Node::variant&>(left) == static_cast<const typename Node::variant&>(right);
+    } else {
+        return left == right;
+    }
+}
+
+// Storage a node owns outside of its pool.
+static std::size_t heap_bytes(const LinearTerm &term)
+{
+    return term.coefs.capacity() * sizeof(term.coefs[0]);
+}
+
+template <typename Node>
+static std::size_t heap_bytes(const Node &node)
+{
+    return 0;
+}
+
+template <typename Node>
+std::size_t NodePool<Node>::allocated_bytes() const
+{
+    return m_chunks.size() * (chunk_mask + 1) * sizeof(Node) + m_chunks.capacity() * sizeof(m_chunks[0])
+        + m_hashes.capacity() * sizeof(m_hashes[0]) + m_table.capacity() * sizeof(m_table[0]) + m_node_heap_bytes;
+}
+
+template <typename Node>
+template <typename Persist>
+NodeRef<Node> NodePool<Node>::intern(Node &&node, std::size_t hash, Persist persist)
+{
+    // Keeps the table at most half full, so the probe sequences stay short.
+    if (2 * (m_hashes.size() + 1) > m_table.size()) {
+        m_table.assign(std::max<std::size_t>(1024, 2 * m_table.size()), empty_slot);
+        const auto mask = m_table.size() - 1;
+        for (std::uint32_t index = 0; index < size(); index++) {
+            auto slot = slot_of(m_hashes[index], mask);
+            while (m_table[slot] != empty_slot) {
+                slot = (slot + 1) & mask;
+            }
+            m_table[slot] = index;
+        }
+    }
+
+    const auto mask = m_table.size() - 1;
+    auto slot = slot_of(hash, mask);
+    for (; m_table[slot] != empty_slot; slot = (slot + 1) & mask) {
+        const auto index = m_table[slot];
+        if (m_hashes[index] == hash && equal_nodes((*this)[index], node)) {
+            return NodeRef<Node>(index);
+        }
+    }
+
+    persist(node);
+    const auto index = size();
+    if ((index & chunk_mask) == 0) {
+        m_chunks.emplace_back().reserve(chunk_mask + 1);
+    }
+    m_chunks.back().push_back(std::move(node));
+    m_hashes.push_back(hash);
+    m_table[slot] = index;
+    // The pool is consistent again, so the proof can be aborted here if it ran out of memory or time.
+    m_node_heap_bytes += heap_bytes(m_chunks.back().back());
+    m_memory.update(allocated_bytes());
+    check_deadline();
+    return NodeRef<Node>(index);
+}
+
+std::span<const FormulaRef> FormulaArena::store_operands(std::span<const FormulaRef> operands)
+{
+    static constexpr std::size_t chunk_size = 4096;
+    if (m_operand_chunks.empty() || m_operand_chunks.back().capacity() - m_operand_chunks.back().size() < operands.size()) {
+        m_operand_chunks.emplace_back().reserve(std::max(chunk_size, operands.size()));
+        m_operand_bytes += m_operand_chunks.back().capacity() * sizeof(FormulaRef);
+        m_operand_memory.update(m_operand_bytes + m_operand_chunks.capacity() * sizeof(m_operand_chunks[0]));
+    }
+    auto &chunk = m_operand_chunks.back();
+    const auto offset = chunk.size();
+    // Not using insert, as the operands might already live in the same chunk.
+    for (const auto &operand : operands) {
+        chunk.push_back(operand);
+    }
+    return std::span<const FormulaRef>(chunk).subspan(offset, operands.size());
+}
+
+TermRef intern(LinearTerm &&term)
+{
+    const auto hash = hash_of(term);
+    return active_arena->pool<LinearTerm>().intern(std::move(term), hash, [](LinearTerm &) {});
+}
+
+AtomRef intern(Atom &&atom)
+{
+    const auto hash = hash_of(atom);
+    return active_arena->pool<Atom>().intern(std::move(atom), hash, [](Atom &) {});
+}
+
+FormulaRef intern(Formula &&formula)
+{
+    const auto hash = hash_of(formula);
+    return active_arena->pool<Formula>().intern(std::move(formula), hash, [](Formula &node) {
+        // The operands of a looked up n-ary node may be borrowed from the caller.
+        if (auto *con = std::get_if<Conjuction>(&node)) {
+            con->operands = active_arena->store_operands(con->operands);
+        } else if (auto *dis = std::get_if<Disjunction>(&node)) {
+            dis->operands = active_arena->store_operands(dis->operands);
+        }
+    });
+}
+
+template <typename NaryType>
+FormulaRef join(std::span<const FormulaRef> operands)
+{
+    const auto is_nested = [](const FormulaRef &operand) { return std::holds_alternative<NaryType>(*operand); };
+    if (std::ranges::none_of(operands, is_nested)) {
+        if (operands.empty()) {
+            return std::is_same_v<NaryType, Conjuction> ? f_ptr<True>() : f_ptr<False>();
+        } else if (operands.size() == 1) {
+            return operands[0];
+        }
+        return intern(Formula(NaryType(operands)));
+    }
+
+    std::vector<FormulaRef> flattened;
+    for (const auto &operand : operands) {
+        if (const auto *node = std::get_if<NaryType>(operand.get())) {
+            flattened.insert(flattened.end(), node->operands.begin(), node->operands.end());
+        } else {
+            flattened.push_back(operand);
+        }
+    }
+    return intern(Formula(NaryType(flattened)));
+}
+
+template FormulaRef join<Conjuction>(std::span<const FormulaRef> operands);
+template FormulaRef join<Disjunction>(std::span<const FormulaRef> operands);
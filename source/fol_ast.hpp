@@ -2,67 +2,120 @@
 #define FOL_AST_HPP
 
 #include "fraction.hpp"
+#include "memory_account.hpp"
+#include "symbol_table.hpp"
 
 #include <string>
-#include <memory>
 #include <variant>
+#include <vector>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <span>
+#include <algorithm>
+#include <functional>
+
+struct LinearTerm;
+struct Atom;
+struct Formula;
 
-struct Term;
-
-struct RationalNumber
+// Handle to a node in the active formula arena - a 32-bit index into the arena's pool for
+// the node kind. Handles are only meaningful while the arena they were created in is active.
+template <typename Node>
+class NodeRef
 {
-    Fraction value;
-};
+public:
+    NodeRef() = default;
+    NodeRef(std::nullptr_t) {}
+    explicit NodeRef(std::uint32_t index) : m_index(index) {}
 
-struct Variable
-{
-    Fraction coef;
-    std::string symbol;
-};
+    std::uint32_t index() const { return m_index; }
 
-struct Addition
-{
-    std::shared_ptr<Term> left, right;
+    Node *get() const;
+    Node &operator*() const;
+    Node *operator->() const { return &**this; }
+
+    explicit operator bool() const { return m_index != null_index; }
+    bool operator==(const NodeRef &other) const = default;
+
+private:
+    static constexpr std::uint32_t null_index = UINT32_MAX;
+
+    std::uint32_t m_index = null_index;
 };
 
-struct Subtraction
+template <typename Node>
+struct std::hash<NodeRef<Node>>
 {
-    std::shared_ptr<Term> left, right;
+    std::size_t operator()(NodeRef<Node> ref) const noexcept { return std::hash<std::uint32_t>{}(ref.index()); }
 };
 
-struct Term : public std::variant<RationalNumber, Variable, Addition, Subtraction>
+using TermRef = NodeRef<LinearTerm>;
+using AtomRef = NodeRef<Atom>;
+using FormulaRef = NodeRef<Formula>;
+
+// A linear combination of variables plus a constant. The variables are sorted by their symbol ids and
+// have non-zero coefficients, so equal linear expressions are always equal terms.
+struct LinearTerm
 {
-    using variant::variant;
+    LinearTerm(const Fraction &constant = Fraction{}) : constant(constant) {}
+    LinearTerm(const Fraction &coef, SymbolId symbol);
+
+    std::vector<std::pair<SymbolId, Fraction>> coefs;
+    Fraction constant;
+
+    Fraction coefficient_of(SymbolId symbol) const;
+
+    LinearTerm operator+(const LinearTerm &other) const;
+    LinearTerm operator-(const LinearTerm &other) const;
+    LinearTerm operator*(const Fraction &factor) const;
+
+    bool operator==(const LinearTerm &other) const = default;
 };
 
+// Atoms relate a linear term to zero - "term REL 0". The term is kept canonical by the atom factory:
+// its first coefficient is 1, or if it has no variables, its constant is either 1 or 0.
 struct EqualTo
 {
-    std::shared_ptr<Term> left, right;
+    TermRef term;
+
+    bool operator==(const EqualTo &other) const = default;
 };
 
 struct LessThan
 {
-    std::shared_ptr<Term> left, right;
+    TermRef term;
+
+    bool operator==(const LessThan &other) const = default;
 };
 
 struct LessOrEqualTo
 {
-    std::shared_ptr<Term> left, right;
+    TermRef term;
+
+    bool operator==(const LessOrEqualTo &other) const = default;
 };
 
 struct GreaterThan
 {
-    std::shared_ptr<Term> left, right;
+    TermRef term;
+
+    bool operator==(const GreaterThan &other) const = default;
 };
 
 struct GreaterOrEqualTo
 {
-    std::shared_ptr<Term> left, right;
+    TermRef term;
+
+    bool operator==(const GreaterOrEqualTo &other) const = default;
 };
 
 struct NotEqualTo
 {
-    std::shared_ptr<Term> left, right;
+    TermRef term;
+
+    bool operator==(const NotEqualTo &other) const = default;
 };
 
 struct Atom : public std::variant<EqualTo, LessThan, LessOrEqualTo, GreaterThan, GreaterOrEqualTo, NotEqualTo>
@@ -70,63 +123,116 @@ struct Atom : public std::variant<EqualTo, LessThan, LessOrEqualTo, GreaterThan,
     using variant::variant;
 };
 
-struct Formula;
+// The relation that holds between the terms of an atom once they are multiplied by a negative factor.
+template <typename T>
+struct Mirrored
+{
+    using type = T;
+};
+
+template <>
+struct Mirrored<LessThan>
+{
+    using type = GreaterThan;
+};
+
+template <>
+struct Mirrored<LessOrEqualTo>
+{
+    using type = GreaterOrEqualTo;
+};
+
+template <>
+struct Mirrored<GreaterThan>
+{
+    using type = LessThan;
+};
+
+template <>
+struct Mirrored<GreaterOrEqualTo>
+{
+    using type = LessOrEqualTo;
+};
 
 struct AtomWrapper
 {
-    std::shared_ptr<Atom> atom;
+    AtomRef atom;
+
+    bool operator==(const AtomWrapper &other) const = default;
 };
 
 struct True
 {
-
+    bool operator==(const True &other) const = default;
 };
 
 struct False
 {
-
+    bool operator==(const False &other) const = default;
 };
 
 struct Negation
 {
-    std::shared_ptr<Formula> operand;
+    FormulaRef operand;
+
+    bool operator==(const Negation &other) const = default;
 };
 
+// Conjuctions and disjunctions are n-ary. They always have at least two operands, none of which is
+// of the same kind as the node itself - nested nodes are flattened into their parent when created.
 struct Conjuction
 {
-    std::shared_ptr<Formula> left, right;
+    std::span<const FormulaRef> operands;
+
+    bool operator==(const Conjuction &other) const { return std::ranges::equal(operands, other.operands); }
 };
 
 struct Disjunction
 {
-    std::shared_ptr<Formula> left, right;
+    std::span<const FormulaRef> operands;
+
+    bool operator==(const Disjunction &other) const { return std::ranges::equal(operands, other.operands); }
 };
 
 struct Implication
 {
-    std::shared_ptr<Formula> left, right;
+    FormulaRef left, right;
+
+    bool operator==(const Implication &other) const = default;
 };
 
 struct Equivalence
 {
-    std::shared_ptr<Formula> left, right;
+    FormulaRef left, right;
+
+    bool operator==(const Equivalence &other) const = default;
 };
 
 struct UniversalQuantification
 {
-    std::string var_symbol;
-    std::shared_ptr<Formula> formula;
+    SymbolId var_symbol;
+    FormulaRef formula;
+
+    bool operator==(const UniversalQuantification &other) const = default;
 };
 
 struct ExistentialQuantification
 {
-    std::string var_symbol;
-    std::shared_ptr<Formula> formula;
+    SymbolId var_symbol;
+    FormulaRef formula;
+
+    bool operator==(const ExistentialQuantification &other) const = default;
 };
 
+// Normalization passes whose results are memoized per formula node.
+enum class CachedPass { SIMPLIFY, NNF, NNF_NOT, PNF, DNF, CNF, COUNT };
+
 struct Formula : public std::variant<AtomWrapper, True, False, Negation, Conjuction, Disjunction, Implication, Equivalence, UniversalQuantification, ExistentialQuantification>
 {
     using variant::variant;
+
+    // Results of the normalization passes over this node, living in the same arena.
+    mutable std::array<FormulaRef, static_cast<std::size_t>(CachedPass::COUNT)> cache;
 };
 
 // For overloaded lambdas...
@@ -139,22 +245,332 @@ struct overloaded : Ts...
 template <typename... Ts>
 overloaded(Ts...) -> overloaded<Ts...>;
 
-template <typename T, typename... Args>
-std::shared_ptr<Term> t_ptr(Args&&... args)
+// Hash-consed pool of nodes of a single kind. Nodes are stored in fixed size chunks, so they
+// never move once created and references to them stay valid while the pool grows.
+template <typename Node>
+class NodePool
+{
+public:
+    Node &operator[](std::uint32_t index)
+    {
+        return m_chunks[index >> chunk_bits][index & chunk_mask];
+    }
+
+    std::uint32_t size() const { return static_cast<std::uint32_t>(m_hashes.size()); }
+
+    // Returns the node structurally equal to the given one if there is one, and a new node otherwise.
+    // A new node is passed to persist before it is stored.
+    template <typename Persist>
+    NodeRef<Node> intern(Node &&node, std::size_t hash, Persist persist);
+
+private:
+    static constexpr std::uint32_t chunk_bits = 12;
+    static constexpr std::uint32_t chunk_mask = (1u << chunk_bits) - 1;
+    static constexpr std::uint32_t empty_slot = UINT32_MAX;
+
+    std::vector<std::vector<Node>> m_chunks;
+    // Hashes of the nodes by index, and an open addressing table of node indices.
+    std::vector<std::size_t> m_hashes;
+    std::vector<std::uint32_t> m_table;
+    // Storage owned by the nodes themselves, like the coefficients of the terms.
+    std::size_t m_node_heap_bytes = 0;
+    MemoryCharge m_memory{MemorySubsystem::AST};
+
+    std::size_t allocated_bytes() const;
+};
+
+// Owns all the nodes created while it is active, and frees them all at once when destroyed. Its memory
+// is charged to the memory account active when it was created.
+class FormulaArena
+{
+public:
+    template <typename Node>
+    NodePool<Node> &pool()
+    {
+        if constexpr (std::is_same_v<Node, LinearTerm>) {
+            return m_terms;
+        } else if constexpr (std::is_same_v<Node, Atom>) {
+            return m_atoms;
+        } else {
+            return m_formulas;
+        }
+    }
+
+    // Copies the operands of a new n-ary node into the arena.
+    std::span<const FormulaRef> store_operands(std::span<const FormulaRef> operands);
+
+    LocalSymbolTable &local_symbols() { return m_local_symbols; }
+
+private:
+    NodePool<LinearTerm> m_terms;
+    NodePool<Atom> m_atoms;
+    NodePool<Formula> m_formulas;
+    // Operand lists of the n-ary nodes. Like the pools, the chunks are never reallocated.
+    std::vector<std::vector<FormulaRef>> m_operand_chunks;
+    std::size_t m_operand_bytes = 0;
+    MemoryCharge m_operand_memory{MemorySubsystem::AST};
+    // The symbols generated by the proof, which are freed along with its nodes.
+    LocalSymbolTable m_local_symbols;
+};
+
+// The arena nodes are created in and handles are resolved against.
+inline thread_local FormulaArena *active_arena = nullptr;
+
+// Makes the given arena, and its local symbols, the active ones for its lifetime.
+class ArenaScope
+{
+public:
+    explicit ArenaScope(FormulaArena &arena) : m_previous(active_arena), m_previous_symbols(active_local_symbols)
+    {
+        active_arena = &arena;
+        active_local_symbols = &arena.local_symbols();
+    }
+    ~ArenaScope()
+    {
+        active_arena = m_previous;
+        active_local_symbols = m_previous_symbols;
+    }
+
+    ArenaScope(const ArenaScope &) = delete;
+    ArenaScope &operator=(const ArenaScope &) = delete;
+
+private:
+    FormulaArena *m_previous;
+    LocalSymbolTable *m_previous_symbols;
+};
+
+template <typename Node>
+Node &NodeRef<Node>::operator*() const
 {
-    return std::make_shared<Term>(T(args...));
+    return active_arena->pool<Node>()[m_index];
 }
 
-template <typename T, typename... Args>
-std::shared_ptr<Atom> a_ptr(Args&&... args)
+template <typename Node>
+Node *NodeRef<Node>::get() const
+{
+    return *this ? &**this : nullptr;
+}
+
+// Hash-consing - children are always hash-consed first, so structurally equal
+// nodes have identical child handles and can be compared shallowly.
+TermRef intern(LinearTerm &&term);
+AtomRef intern(Atom &&atom);
+FormulaRef intern(Formula &&formula);
+
+// Scales the term into its canonical form, returning true if the factor was negative.
+bool canonicalize(LinearTerm &term);
+
+// Builds the atom of a term that is already canonical.
+template <typename T>
+AtomRef a_ptr(TermRef term)
 {
-    return std::make_shared<Atom>(T(args...));
+    return intern(Atom(T(term)));
 }
 
+// Builds the atom "left REL right", brought into its canonical form "term REL 0".
+template <typename T>
+AtomRef a_ptr(const LinearTerm &left, const LinearTerm &right)
+{
+    auto term = left - right;
+    if (canonicalize(term)) {
+        return a_ptr<typename Mirrored<T>::type>(intern(std::move(term)));
+    }
+    return a_ptr<T>(intern(std::move(term)));
+}
+
+// Builds the flattened conjuction (disjunction) of the operands. Returns the operand itself if there is
+// just one, and True (False) if there are none.
+template <typename NaryType>
+FormulaRef join(std::span<const FormulaRef> operands);
+
 template <typename T, typename... Args>
-std::shared_ptr<Formula> f_ptr(Args&&... args)
+FormulaRef f_ptr(Args&&... args)
+{
+    if constexpr (std::is_same_v<T, Conjuction> || std::is_same_v<T, Disjunction>) {
+        if constexpr (sizeof...(Args) == 1 && (std::ranges::range<Args> && ...)) {
+            return join<T>(args...);
+        } else {
+            const std::array<FormulaRef, sizeof...(Args)> operands{args...};
+            return join<T>(operands);
+        }
+    } else {
+        return intern(Formula(T(args...)));
+    }
+}
+
+// Applies the pass to every operand of the n-ary node, joining the results with ResultType.
+template <typename ResultType, typename NaryType, typename Pass>
+FormulaRef map_operands(const NaryType &node, Pass pass)
+{
+    std::vector<FormulaRef> operands;
+    operands.reserve(node.operands.size());
+    for (const auto &operand : node.operands) {
+        operands.push_back(pass(operand));
+    }
+    return f_ptr<ResultType>(operands);
+}
+
+// Rebuilds the formula with every direct subformula replaced by its result of the pass.
+template <typename Pass>
+FormulaRef map_subformulas(FormulaRef formula, Pass pass)
+{
+    return std::visit(
+        overloaded{
+            [&pass](const Negation &node) {
+                return f_ptr<Negation>(pass(node.operand));
+            },
+            [&pass](const Conjuction &node) {
+                return map_operands<Conjuction>(node, pass);
+            },
+            [&pass](const Disjunction &node) {
+                return map_operands<Disjunction>(node, pass);
+            },
+            [&pass](const Implication &node) {
+                return f_ptr<Implication>(pass(node.left), pass(node.right));
+            },
+            [&pass](const Equivalence &node) {
+                return f_ptr<Equivalence>(pass(node.left), pass(node.right));
+            },
+            [&pass](const UniversalQuantification &node) {
+                return f_ptr<UniversalQuantification>(node.var_symbol, pass(node.formula));
+            },
+            [&pass](const ExistentialQuantification &node) {
+                return f_ptr<ExistentialQuantification>(node.var_symbol, pass(node.formula));
+            },
+            [&formula](const auto &node) {
+                return formula;
+            }
+        }, *formula
+    );
+}
+
+// Calls visit on every direct subformula of the formula.
+template <typename Visit>
+void for_each_subformula(const Formula &formula, Visit visit)
+{
+    std::visit(
+        overloaded{
+            [&visit](const Negation &node) {
+                visit(node.operand);
+            },
+            [&visit](const Conjuction &node) {
+                std::for_each(node.operands.begin(), node.operands.end(), visit);
+            },
+            [&visit](const Disjunction &node) {
+                std::for_each(node.operands.begin(), node.operands.end(), visit);
+            },
+            [&visit](const Implication &node) {
+                visit(node.left);
+                visit(node.right);
+            },
+            [&visit](const Equivalence &node) {
+                visit(node.left);
+                visit(node.right);
+            },
+            [&visit](const UniversalQuantification &node) {
+                visit(node.formula);
+            },
+            [&visit](const ExistentialQuantification &node) {
+                visit(node.formula);
+            },
+            [](const auto &node) {
+
+            }
+        }, formula
+    );
+}
+
+// A pass applied to a formula.
+struct PassApplication
+{
+    FormulaRef formula;
+    CachedPass pass;
+};
+
+inline FormulaRef &cached_result(const PassApplication &application)
+{
+    return application.formula->cache[static_cast<std::size_t>(application.pass)];
+}
+
+// Dependencies of a pass whose result for a formula is built from its results for the direct subformulas.
+inline void subformula_dependencies(FormulaRef formula, CachedPass pass, std::vector<PassApplication> &dependencies)
+{
+    for_each_subformula(*formula, [pass, &dependencies](FormulaRef subformula) {
+        dependencies.push_back({subformula, pass});
+    });
+}
+
+// Returns the memoized result of the pass over the formula, computing and caching it if needed.
+// dependencies lists the pass applications compute needs the results of for a given formula. They
+// are all evaluated first, bottom-up with an explicit work stack, so compute always finds them in
+// the cache and the depth of a formula is never limited by the call stack.
+template <typename Dependencies, typename Compute>
+FormulaRef memoize(FormulaRef formula, CachedPass pass, Dependencies dependencies, Compute compute)
+{
+    if (const auto cached = cached_result({formula, pass})) {
+        return cached;
+    }
+
+    // Each application is expanded into its dependencies first, and computed when it comes up again.
+    std::vector<std::pair<PassApplication, bool>> stack{{{formula, pass}, false}};
+    std::vector<PassApplication> pending;
+    while (!stack.empty()) {
+        const auto [application, is_expanded] = stack.back();
+        if (cached_result(application)) {
+            stack.pop_back();
+        } else if (!is_expanded) {
+            stack.back().second = true;
+            pending.clear();
+            dependencies(application.formula, application.pass, pending);
+            for (auto it = pending.rbegin(); it != pending.rend(); it++) {
+                if (!cached_result(*it)) {
+                    stack.push_back({*it, false});
+                }
+            }
+        } else {
+            stack.pop_back();
+            const auto result = compute(application.formula, application.pass);
+            cached_result(application) = result;
+        }
+    }
+    return cached_result({formula, pass});
+}
+
+// Like memoize, for the passes whose result for a formula depends on more than the formula - like
+// a substitution, or a walk that tracks the polarity of the subformulas. The results are kept in a map
+// owned by the caller, by a key identifying the application of the pass to a formula, so they can be
+// reused across calls within the pass. dependencies lists the keys compute needs the results of for
+// a given key, which compute finds in the map.
+template <typename Map, typename Dependencies, typename Compute>
+const typename Map::mapped_type &memoize_in(Map &results, const typename Map::key_type &key, Dependencies dependencies, Compute compute)
 {
-    return std::make_shared<Formula>(T(args...));
+    using Key = typename Map::key_type;
+    if (const auto it = results.find(key); it != results.end()) {
+        return it->second;
+    }
+
+    std::vector<std::pair<Key, bool>> stack{{key, false}};
+    std::vector<Key> pending;
+    while (!stack.empty()) {
+        const auto [current, is_expanded] = stack.back();
+        if (results.contains(current)) {
+            stack.pop_back();
+        } else if (!is_expanded) {
+            stack.back().second = true;
+            pending.clear();
+            dependencies(current, pending);
+            for (auto it = pending.rbegin(); it != pending.rend(); it++) {
+                if (!results.contains(*it)) {
+                    stack.push_back({*it, false});
+                }
+            }
+        } else {
+            stack.pop_back();
+            auto result = compute(current);
+            results.emplace(current, std::move(result));
+        }
+    }
+    return results.find(key)->second;
 }
 
 #endif // FOL_AST_HPP
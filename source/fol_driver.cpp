@@ -1,9 +1,9 @@
 #include "fol_driver.hpp"
 
-std::shared_ptr<Formula> FOLDriver::parse(const std::string &formula)
+FormulaRef FOLDriver::parse(const std::string &formula)
 {
     string_scan_init(formula);
-    yy::parser parser(*this);
+    yy::parser parser(*this, m_scanner);
     int res = parser();
     string_scan_deinit();
 
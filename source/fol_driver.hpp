@@ -4,7 +4,6 @@
 #include "fol_ast.hpp"
 #include "fol_parser.tab.hpp"
 
-#include <memory>
 
 class FOLDriver
 {
@@ -12,7 +11,7 @@ class FOLDriver
     friend class yy::parser;
 
 public:
-    std::shared_ptr<Formula> parse(const std::string &formula);
+    FormulaRef parse(const std::string &formula);
 
 private:
     // Implemented in the lexer file - alternatively,
@@ -20,12 +19,14 @@ private:
     void string_scan_init(const std::string &formula);
     void string_scan_deinit();
 
-    std::shared_ptr<Formula> m_ast;
+    FormulaRef m_ast;
+    // State of the reentrant scanner, so that separate drivers can parse at the same time.
+    void *m_scanner = nullptr;
 };
 
-// By default, yylex's signature is int yylex(void),
-// so we have to redefine it.
-#define YY_DECL yy::parser::symbol_type yylex(FOLDriver &driver)
+// By default, yylex's signature is int yylex(yyscan_t yyscanner),
+// so we have to redefine it. The scanner state must keep its name.
+#define YY_DECL yy::parser::symbol_type yylex(FOLDriver &driver, void *yyscanner)
 // Declare yylex for use in the parser.
 YY_DECL;
 
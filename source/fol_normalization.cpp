@@ -1,10 +1,16 @@
 #include "fol_normalization.hpp"
+#include "trace.hpp"
 
 #include <variant>
 #include <cassert>
 #include <set>
+#include <vector>
+#include <type_traits>
+#include <span>
+#include <algorithm>
+#include <unordered_map>
 
-std::shared_ptr<Formula> simplify(std::shared_ptr<Formula> formula)
+FormulaRef simplify(FormulaRef formula)
 {
     static constexpr auto simplify_negation = [](const Negation &f) {
         const auto subformula = simplify(f.operand);
@@ -24,31 +30,29 @@ std::shared_ptr<Formula> simplify(std::shared_ptr<Formula> formula)
     };
 
     static constexpr auto simplify_conjuction = [](const Conjuction &f) {
-        const auto l_subformula = simplify(f.left);
-        const auto r_subformula = simplify(f.right);
-        if (std::holds_alternative<False>(*l_subformula) || std::holds_alternative<False>(*r_subformula)) {
-            return f_ptr<False>();
-        } else if (std::holds_alternative<True>(*l_subformula)) {
-            return r_subformula;
-        } else if (std::holds_alternative<True>(*r_subformula)) {
-            return l_subformula;
-        } else {
-            return f_ptr<Conjuction>(l_subformula, r_subformula);
+        std::vector<FormulaRef> subformulas;
+        for (const auto &operand : f.operands) {
+            const auto subformula = simplify(operand);
+            if (std::holds_alternative<False>(*subformula)) {
+                return f_ptr<False>();
+            } else if (!std::holds_alternative<True>(*subformula)) {
+                subformulas.push_back(subformula);
+            }
         }
+        return f_ptr<Conjuction>(subformulas);
     };
 
     static constexpr auto simplify_disjunction = [](const Disjunction &f) {
-        const auto l_subformula = simplify(f.left);
-        const auto r_subformula = simplify(f.right);
-        if (std::holds_alternative<True>(*l_subformula) || std::holds_alternative<True>(*r_subformula)) {
-            return f_ptr<True>();
-        } else if (std::holds_alternative<False>(*l_subformula)) {
-            return r_subformula;
-        } else if (std::holds_alternative<False>(*r_subformula)) {
-            return l_subformula;
-        } else {
-            return f_ptr<Disjunction>(l_subformula, r_subformula);
+        std::vector<FormulaRef> subformulas;
+        for (const auto &operand : f.operands) {
+            const auto subformula = simplify(operand);
+            if (std::holds_alternative<True>(*subformula)) {
+                return f_ptr<True>();
+            } else if (!std::holds_alternative<False>(*subformula)) {
+                subformulas.push_back(subformula);
+            }
         }
+        return f_ptr<Disjunction>(subformulas);
     };
 
     static constexpr auto simplify_implication = [](const Implication &f) {
@@ -77,7 +81,7 @@ std::shared_ptr<Formula> simplify(std::shared_ptr<Formula> formula)
         } else if (std::holds_alternative<False>(*r_subformula)) {
             return f_ptr<Negation>(l_subformula);
         } else {
-            return f_ptr<Implication>(l_subformula, r_subformula);
+            return f_ptr<Equivalence>(l_subformula, r_subformula);
         }
     };
 
@@ -99,39 +103,69 @@ std::shared_ptr<Formula> simplify(std::shared_ptr<Formula> formula)
         }
     };
 
-    return std::visit(
+    return memoize(formula, CachedPass::SIMPLIFY, subformula_dependencies, [](FormulaRef formula, CachedPass pass) {
+        return std::visit(
+            overloaded{
+                [](const Negation &node) {
+                    return simplify_negation(node);
+                },
+                [](const Conjuction &node) {
+                    return simplify_conjuction(node);
+                },
+                [](const Disjunction &node) {
+                    return simplify_disjunction(node);
+                },
+                [](const Implication &node) {
+                    return simplify_implication(node);
+                },
+                [](const Equivalence &node) {
+                    return simplify_equivalence(node);
+                },
+                [](const UniversalQuantification &node) {
+                    return simplify_universal_quantification(node);
+                },
+                [](const ExistentialQuantification &node) {
+                    return simplify_existential_quantification(node);
+                },
+                [&formula](const auto &node) {
+                    return formula;
+                }
+            }, *formula
+        );
+    });
+}
+
+static FormulaRef nnf_h(FormulaRef formula);
+static FormulaRef nnf_not(FormulaRef formula);
+
+// The NNF of a formula depends on the NNF of its subformulas, and on the NNF of their negations
+// when they are negated, on the left side of an implication, or are a side of an equivalence.
+static void nnf_dependencies(FormulaRef formula, CachedPass pass, std::vector<PassApplication> &dependencies)
+{
+    const auto flipped = pass == CachedPass::NNF ? CachedPass::NNF_NOT : CachedPass::NNF;
+    std::visit(
         overloaded{
-            [](const Negation &node) {
-                return simplify_negation(node);
-            },
-            [](const Conjuction &node) {
-                return simplify_conjuction(node);
-            },
-            [](const Disjunction &node) {
-                return simplify_disjunction(node);
-            },
-            [](const Implication &node) {
-                return simplify_implication(node);
-            },
-            [](const Equivalence &node) {
-                return simplify_equivalence(node);
+            [&dependencies, flipped](const Negation &node) {
+                dependencies.push_back({node.operand, flipped});
             },
-            [](const UniversalQuantification &node) {
-                return simplify_universal_quantification(node);
+            [&dependencies, pass, flipped](const Implication &node) {
+                dependencies.push_back({node.left, flipped});
+                dependencies.push_back({node.right, pass});
             },
-            [](const ExistentialQuantification &node) {
-                return simplify_existential_quantification(node);
+            [&dependencies](const Equivalence &node) {
+                for (const auto operand_pass : {CachedPass::NNF, CachedPass::NNF_NOT}) {
+                    dependencies.push_back({node.left, operand_pass});
+                    dependencies.push_back({node.right, operand_pass});
+                }
             },
-            [&formula](const auto &node) {
-                return formula;
+            [&formula, &dependencies, pass](const auto &node) {
+                subformula_dependencies(formula, pass, dependencies);
             }
         }, *formula
     );
 }
 
-static std::shared_ptr<Formula> nnf_h(std::shared_ptr<Formula> formula);
-
-static std::shared_ptr<Formula> nnf_not(std::shared_ptr<Formula> formula)
+static FormulaRef nnf_of_negation(FormulaRef formula)
 {
     return std::visit(
         overloaded{
@@ -142,10 +176,10 @@ static std::shared_ptr<Formula> nnf_not(std::shared_ptr<Formula> formula)
                 return nnf_h(node.operand);
             },
             [](const Conjuction &node) {
-                return f_ptr<Disjunction>(nnf_not(node.left), nnf_not(node.right));
+                return map_operands<Disjunction>(node, nnf_not);
             },
             [](const Disjunction &node) {
-                return f_ptr<Conjuction>(nnf_not(node.left), nnf_not(node.right));
+                return map_operands<Conjuction>(node, nnf_not);
             },
             [](const Implication &node) {
                 return f_ptr<Conjuction>(nnf_h(node.left), nnf_not(node.right));;
@@ -160,7 +194,7 @@ static std::shared_ptr<Formula> nnf_not(std::shared_ptr<Formula> formula)
                 return f_ptr<ExistentialQuantification>(node.var_symbol, nnf_not(node.formula));
             },
             [](const ExistentialQuantification &node) {
-                return f_ptr<ExistentialQuantification>(node.var_symbol, nnf_not(node.formula));
+                return f_ptr<UniversalQuantification>(node.var_symbol, nnf_not(node.formula));
             },
             [&formula](const auto &node) {
                 assert(!"Unreachable");
@@ -170,7 +204,7 @@ static std::shared_ptr<Formula> nnf_not(std::shared_ptr<Formula> formula)
     );
 }
 
-static std::shared_ptr<Formula> nnf_h(std::shared_ptr<Formula> formula)
+static FormulaRef nnf_of_formula(FormulaRef formula)
 {
     return std::visit(
         overloaded{
@@ -178,10 +212,10 @@ static std::shared_ptr<Formula> nnf_h(std::shared_ptr<Formula> formula)
                 return nnf_not(node.operand);
             },
             [](const Conjuction &node) {
-                return f_ptr<Conjuction>(nnf_h(node.left), nnf_h(node.right));
+                return map_operands<Conjuction>(node, nnf_h);
             },
             [](const Disjunction &node) {
-                return f_ptr<Disjunction>(nnf_h(node.left), nnf_h(node.right));
+                return map_operands<Disjunction>(node, nnf_h);
             },
             [](const Implication &node) {
                 return f_ptr<Disjunction>(nnf_not(node.left), nnf_h(node.right));;
@@ -205,280 +239,294 @@ static std::shared_ptr<Formula> nnf_h(std::shared_ptr<Formula> formula)
     );
 }
 
-std::shared_ptr<Formula> nnf(std::shared_ptr<Formula> formula)
+static FormulaRef nnf_not(FormulaRef formula)
 {
+    return memoize(formula, CachedPass::NNF_NOT, nnf_dependencies, [](FormulaRef formula, CachedPass pass) {
+        return pass == CachedPass::NNF ? nnf_of_formula(formula) : nnf_of_negation(formula);
+    });
+}
+
+static FormulaRef nnf_h(FormulaRef formula)
+{
+    return memoize(formula, CachedPass::NNF, nnf_dependencies, [](FormulaRef formula, CachedPass pass) {
+        return pass == CachedPass::NNF ? nnf_of_formula(formula) : nnf_of_negation(formula);
+    });
+}
+
+FormulaRef nnf(FormulaRef formula)
+{
+    TraceSpan span("nnf");
     return nnf_h(simplify(formula));
 }
 
-static void collect_free_variables(std::shared_ptr<Term> term, std::set<std::string> &free_vars)
+static void collect_free_variables(TermRef term, std::set<SymbolId> &free_vars)
 {
-    std::visit(
-        overloaded{
-            [](const RationalNumber &node) {
-            },
-            [&free_vars](const Variable &node) {
-                free_vars.insert(node.symbol);
-            },
-            [&free_vars](const Addition &node) {
-                collect_free_variables(node.left, free_vars);
-                collect_free_variables(node.right, free_vars);
-            },
-            [&free_vars](const Subtraction &node) {
-                collect_free_variables(node.left, free_vars);
-                collect_free_variables(node.right, free_vars);
-            }
-        }, *term
-    );
+    for (const auto &[symbol, coef] : term->coefs) {
+        free_vars.insert(symbol);
+    }
 }
 
-static void collect_free_variables(std::shared_ptr<Atom> atom, std::set<std::string> &free_vars)
+static void collect_free_variables(AtomRef atom, std::set<SymbolId> &free_vars)
 {
     std::visit(
-        overloaded{
-            [&free_vars](const EqualTo &node) {
-                collect_free_variables(node.left, free_vars);
-                collect_free_variables(node.right, free_vars);
-            },
-            [&free_vars](const LessThan &node) {
-                collect_free_variables(node.left, free_vars);
-                collect_free_variables(node.right, free_vars);
-            },
-            [&free_vars](const LessOrEqualTo &node) {
-                collect_free_variables(node.left, free_vars);
-                collect_free_variables(node.right, free_vars);
-            },
-            [&free_vars](const GreaterThan &node) {
-                collect_free_variables(node.left, free_vars);
-                collect_free_variables(node.right, free_vars);
-            },
-            [&free_vars](const GreaterOrEqualTo &node) {
-                collect_free_variables(node.left, free_vars);
-                collect_free_variables(node.right, free_vars);
-            },
-            [&free_vars](const NotEqualTo &node) {
-                collect_free_variables(node.left, free_vars);
-                collect_free_variables(node.right, free_vars);
-            }
+        [&free_vars](const auto &node) {
+            collect_free_variables(node.term, free_vars);
         }, *atom
     );
 }
 
-static void collect_free_variables(std::shared_ptr<Formula> formula, std::set<std::string> &free_vars)
+static void collect_free_variables(FormulaRef formula, std::set<SymbolId> &free_vars)
 {
-    std::visit(
-        overloaded{
-            [&free_vars](const AtomWrapper &node) {
-                collect_free_variables(node.atom, free_vars);
-            },
-            [&free_vars](const Negation &node) {
-                collect_free_variables(node.operand, free_vars);
-            },
-            [&free_vars](const Conjuction &node) {
-                collect_free_variables(node.left, free_vars);
-                collect_free_variables(node.right, free_vars);
-            },
-            [&free_vars](const Disjunction &node) {
-                collect_free_variables(node.left, free_vars);
-                collect_free_variables(node.right, free_vars);
-            },
-            [&free_vars](const Implication &node) {
-                collect_free_variables(node.left, free_vars);
-                collect_free_variables(node.right, free_vars);
-            },
-            [&free_vars](const Equivalence &node) {
-                collect_free_variables(node.left, free_vars);
-                collect_free_variables(node.right, free_vars);
-            },
-            [&free_vars](const UniversalQuantification &node) {
-                bool is_free = free_vars.contains(node.var_symbol);
-                collect_free_variables(node.formula, free_vars);
-                if (!is_free) {
-                    free_vars.erase(node.var_symbol);
-                }
-            },
-            [&free_vars](const ExistentialQuantification &node) {
-                bool is_free = free_vars.contains(node.var_symbol);
-                collect_free_variables(node.formula, free_vars);
-                if (!is_free) {
-                    free_vars.erase(node.var_symbol);
+    // The variables bound by the quantifiers above the visited node. Every stack entry remembers how many
+    // of them are in its scope, so the ones bound within an already visited sibling can be dropped.
+    std::vector<SymbolId> bound_vars;
+    std::vector<std::pair<FormulaRef, std::size_t>> stack{{formula, 0}};
+    std::set<SymbolId> atom_vars;
+    while (!stack.empty()) {
+        const auto current = stack.back().first;
+        bound_vars.resize(stack.back().second);
+        stack.pop_back();
+        std::visit(
+            overloaded{
+                [&free_vars, &bound_vars, &atom_vars](const AtomWrapper &node) {
+                    atom_vars.clear();
+                    collect_free_variables(node.atom, atom_vars);
+                    for (const auto &var : atom_vars) {
+                        if (std::find(bound_vars.cbegin(), bound_vars.cend(), var) == bound_vars.cend()) {
+                            free_vars.insert(var);
+                        }
+                    }
+                },
+                [&bound_vars, &stack](const UniversalQuantification &node) {
+                    bound_vars.push_back(node.var_symbol);
+                    stack.push_back({node.formula, bound_vars.size()});
+                },
+                [&bound_vars, &stack](const ExistentialQuantification &node) {
+                    bound_vars.push_back(node.var_symbol);
+                    stack.push_back({node.formula, bound_vars.size()});
+                },
+                [&current, &bound_vars, &stack](const auto &node) {
+                    for_each_subformula(*current, [&bound_vars, &stack](FormulaRef subformula) {
+                        stack.push_back({subformula, bound_vars.size()});
+                    });
                 }
-            },
-            [](const auto &node) {
-
-            }
-        }, *formula
-    );
+            }, *current
+        );
+    }
 }
 
-static void collect_quantified_variables(std::shared_ptr<Formula> formula, std::set<std::string> &quantified_vars)
+static void collect_quantified_variables(FormulaRef formula, std::set<SymbolId> &quantified_vars)
 {
-    std::visit(
-        overloaded{
-            [&quantified_vars](const Negation &node) {
-                collect_quantified_variables(node.operand, quantified_vars);
-            },
-            [&quantified_vars](const Conjuction &node) {
-                collect_quantified_variables(node.left, quantified_vars);
-                collect_quantified_variables(node.right, quantified_vars);
-            },
-            [&quantified_vars](const Disjunction &node) {
-                collect_quantified_variables(node.left, quantified_vars);
-                collect_quantified_variables(node.right, quantified_vars);
-            },
-            [&quantified_vars](const Implication &node) {
-                collect_quantified_variables(node.left, quantified_vars);
-                collect_quantified_variables(node.right, quantified_vars);
-            },
-            [&quantified_vars](const Equivalence &node) {
-                collect_quantified_variables(node.left, quantified_vars);
-                collect_quantified_variables(node.right, quantified_vars);
-            },
-            [&quantified_vars](const UniversalQuantification &node) {
-                quantified_vars.insert(node.var_symbol);
-            },
-            [&quantified_vars](const ExistentialQuantification &node) {
-                quantified_vars.insert(node.var_symbol);
-            },
-            [](const auto &node) {
-
-            }
-        }, *formula
-    );
+    std::vector<FormulaRef> stack{formula};
+    while (!stack.empty()) {
+        const auto current = stack.back();
+        stack.pop_back();
+        std::visit(
+            overloaded{
+                [&quantified_vars](const UniversalQuantification &node) {
+                    quantified_vars.insert(node.var_symbol);
+                },
+                [&quantified_vars](const ExistentialQuantification &node) {
+                    quantified_vars.insert(node.var_symbol);
+                },
+                [&current, &stack](const auto &node) {
+                    for_each_subformula(*current, [&stack](FormulaRef subformula) {
+                        stack.push_back(subformula);
+                    });
+                }
+            }, *current
+        );
+    }
 }
 
-static std::string generate_unique_variable(const std::string &var, const std::set<std::string> &free_vars)
+static SymbolId generate_unique_variable(SymbolId var, const std::set<SymbolId> &free_vars)
 {
-    std::string new_var = var;
+    auto new_var = var;
     unsigned counter = 0;
     while (free_vars.contains(new_var)) {
-        new_var = var + std::to_string(counter);
+        new_var = intern_local_symbol(symbol_name(var) + std::to_string(counter));
         counter++;
     }
     return new_var;
 }
 
-static std::shared_ptr<Term> substitute(std::shared_ptr<Term> term, const std::string &var, const std::string &s_var)
+static FormulaRef substitute(FormulaRef formula, SymbolId var, SymbolId s_var);
+
+// Substitutes for the free occurrences of var, rewriting every atom with rewrite_atom. A quantifier that
+// would capture one of the variables the substitution brings in is renamed first. The formula is walked
+// with an explicit work stack, so its depth is never limited by the call stack.
+template <typename RewriteAtom>
+static FormulaRef substitute_free(FormulaRef formula, SymbolId var, const std::set<SymbolId> &introduced_vars, RewriteAtom rewrite_atom)
 {
-    return std::visit(
-        overloaded{
-            [&term](const RationalNumber &node) {
-                return term;
-            },
-            [&term, &var, &s_var](const Variable &node) {
-                return node.symbol == var ? t_ptr<Variable>(node.coef, s_var) : term;
-            },
-            [&var, &s_var](const Addition &node) {
-                return t_ptr<Addition>(substitute(node.left, var, s_var), substitute(node.right, var, s_var));
-            },
-            [&var, &s_var](const Subtraction &node) {
-                return t_ptr<Subtraction>(substitute(node.left, var, s_var), substitute(node.right, var, s_var));
+    std::unordered_map<FormulaRef, FormulaRef> results;
+    // The variable and body the quantifiers which had to be renamed were renamed to.
+    std::unordered_map<FormulaRef, std::pair<SymbolId, FormulaRef>> renamed;
+
+    const auto scope = [&var, &introduced_vars, &renamed](FormulaRef quantified, SymbolId bound_var, FormulaRef body) {
+        if (bound_var == var) {
+            return FormulaRef();
+        }
+        if (!introduced_vars.contains(bound_var)) {
+            return body;
+        }
+        auto used_vars = introduced_vars;
+        collect_free_variables(body, used_vars);
+        used_vars.insert(var);
+        const auto new_var = generate_unique_variable(bound_var, used_vars);
+        const auto new_body = substitute(body, bound_var, new_var);
+        renamed.emplace(quantified, std::make_pair(new_var, new_body));
+        return new_body;
+    };
+
+    const auto dependencies = [&scope](FormulaRef current, std::vector<FormulaRef> &pending) {
+        const auto push_scope = [&current, &scope, &pending](SymbolId bound_var, FormulaRef body) {
+            if (const auto scoped = scope(current, bound_var, body)) {
+                pending.push_back(scoped);
             }
-        }, *term
-    );
-}
+        };
+        std::visit(
+            overloaded{
+                [&push_scope](const UniversalQuantification &node) {
+                    push_scope(node.var_symbol, node.formula);
+                },
+                [&push_scope](const ExistentialQuantification &node) {
+                    push_scope(node.var_symbol, node.formula);
+                },
+                [&current, &pending](const auto &node) {
+                    for_each_subformula(*current, [&pending](FormulaRef subformula) {
+                        pending.push_back(subformula);
+                    });
+                }
+            }, *current
+        );
+    };
 
-static std::shared_ptr<Atom> substitute(std::shared_ptr<Atom> atom, const std::string &var, const std::string &s_var)
-{
-    return std::visit(
-        overloaded{
-            [&var, &s_var](const EqualTo &node) {
-                return a_ptr<EqualTo>(substitute(node.left, var, s_var), substitute(node.right, var, s_var));
-            },
-            [&var, &s_var](const LessThan &node) {
-                return a_ptr<LessThan>(substitute(node.left, var, s_var), substitute(node.right, var, s_var));
-            },
-            [&var, &s_var](const LessOrEqualTo &node) {
-                return a_ptr<LessOrEqualTo>(substitute(node.left, var, s_var), substitute(node.right, var, s_var));
-            },
-            [&var, &s_var](const GreaterThan &node) {
-                return a_ptr<GreaterThan>(substitute(node.left, var, s_var), substitute(node.right, var, s_var));
-            },
-            [&var, &s_var](const GreaterOrEqualTo &node) {
-                return a_ptr<GreaterOrEqualTo>(substitute(node.left, var, s_var), substitute(node.right, var, s_var));
-            },
-            [&var, &s_var](const NotEqualTo &node) {
-                return a_ptr<NotEqualTo>(substitute(node.left, var, s_var), substitute(node.right, var, s_var));
+    const auto compute = [&var, &rewrite_atom, &results, &renamed](FormulaRef current) {
+        const auto result_of = [&results](FormulaRef subformula) {
+            return results.at(subformula);
+        };
+        const auto substitute_scope = [&current, &var, &results, &renamed]<typename QuantifierType>(const QuantifierType &node) {
+            if (node.var_symbol == var) {
+                return current;
             }
-        }, *atom
-    );
+            if (const auto it = renamed.find(current); it != renamed.end()) {
+                return f_ptr<QuantifierType>(it->second.first, results.at(it->second.second));
+            }
+            return f_ptr<QuantifierType>(node.var_symbol, results.at(node.formula));
+        };
+        return std::visit(
+            overloaded{
+                [&rewrite_atom](const AtomWrapper &node) {
+                    return f_ptr<AtomWrapper>(rewrite_atom(node.atom));
+                },
+                [&substitute_scope](const UniversalQuantification &node) {
+                    return substitute_scope(node);
+                },
+                [&substitute_scope](const ExistentialQuantification &node) {
+                    return substitute_scope(node);
+                },
+                [&current, &result_of](const auto &node) {
+                    return map_subformulas(current, result_of);
+                }
+            }, *current
+        );
+    };
+
+    return memoize_in(results, formula, dependencies, compute);
 }
 
-static std::shared_ptr<Formula> substitute(std::shared_ptr<Formula> formula, const std::string &var, const std::string &s_var)
+// Renames the free occurrences of var to s_var.
+static FormulaRef substitute(FormulaRef formula, SymbolId var, SymbolId s_var)
 {
-    return std::visit(
-        overloaded{
-            [&var, &s_var](const AtomWrapper &node) {
-                return f_ptr<AtomWrapper>(substitute(node.atom, var, s_var));
-            },
-            [&formula](const True &node) {
-                return formula;
-            },
-            [&formula](const False &node) {
-                return formula;
-            },
-            [&var, &s_var](const Negation &node) {
-                return f_ptr<Negation>(substitute(node.operand, var, s_var));
-            },
-            [&var, &s_var](const Conjuction &node) {
-                return f_ptr<Conjuction>(substitute(node.left, var, s_var), substitute(node.right, var, s_var));
-            },
-            [&var, &s_var](const Disjunction &node) {
-                return f_ptr<Disjunction>(substitute(node.left, var, s_var), substitute(node.right, var, s_var));
-            },
-            [&var, &s_var](const Implication &node) {
-                return f_ptr<Implication>(substitute(node.left, var, s_var), substitute(node.right, var, s_var));
-            },
-            [&var, &s_var](const Equivalence &node) {
-                return f_ptr<Equivalence>(substitute(node.left, var, s_var), substitute(node.right, var, s_var));
-            },
-            [&formula, &var, &s_var](const UniversalQuantification &node) {
-                if (node.var_symbol == var) {
-                    return formula;
-                }
-                if (node.var_symbol == s_var) {
-                    const auto new_var = generate_unique_variable(node.var_symbol, {s_var});
-                    const auto new_subformula = substitute(node.formula, node.var_symbol, new_var);
-                    return f_ptr<UniversalQuantification>(new_var, substitute(new_subformula, var, s_var));
-                } else {
-                    return f_ptr<UniversalQuantification>(node.var_symbol, substitute(node.formula, var, s_var));
-                }
-            },
-            [&formula, &var, &s_var](const ExistentialQuantification &node) {
-                if (node.var_symbol == var) {
-                    return formula;
-                }
-                if (node.var_symbol == s_var) {
-                    const auto new_var = generate_unique_variable(node.var_symbol, {s_var});
-                    const auto new_subformula = substitute(node.formula, node.var_symbol, new_var);
-                    return f_ptr<ExistentialQuantification>(new_var, substitute(new_subformula, var, s_var));
-                } else {
-                    return f_ptr<ExistentialQuantification>(node.var_symbol, substitute(node.formula, var, s_var));
+    return substitute_free(formula, var, {s_var}, [&var, &s_var](AtomRef atom) {
+        return std::visit(
+            [&atom, &var, &s_var](const auto &node) {
+                using AtomType = std::decay_t<decltype(node)>;
+                const auto coef = node.term->coefficient_of(var);
+                if (coef == Fraction{}) {
+                    return atom;
                 }
-            }
-        }, *formula
-    );
+                // Renaming may reorder the variables, so the atom is brought into canonical form again.
+                return a_ptr<AtomType>(*node.term - LinearTerm(coef, var) + LinearTerm(coef, s_var), LinearTerm());
+            }, *atom
+        );
+    });
 }
 
-static std::shared_ptr<Formula> pull_quantifiers(std::shared_ptr<Formula> formula);
+template <typename NaryType>
+static FormulaRef pull_quantifiers(FormulaRef left, FormulaRef right);
 
-template<typename BinaryType, typename QuantifierType>
-static std::shared_ptr<Formula> pull_quantifiers(const BinaryType &node, const QuantifierType &quant, bool quantifier_on_left)
+template <typename NaryType, typename QuantifierType>
+static FormulaRef pull_quantifiers(FormulaRef left, FormulaRef right, const QuantifierType &quant, bool quantifier_on_left)
 {
-    std::set<std::string> free_vars;
-    collect_free_variables(quantifier_on_left ? node.right : node.left, free_vars);
+    std::set<SymbolId> free_vars;
+    collect_free_variables(quantifier_on_left ? right : left, free_vars);
     if (free_vars.contains(quant.var_symbol)) {
         const auto new_var = generate_unique_variable(quant.var_symbol, free_vars);
         const auto new_subformula = substitute(quant.formula, quant.var_symbol, new_var);
-        return f_ptr<QuantifierType>(new_var, pull_quantifiers(quantifier_on_left ? f_ptr<BinaryType>(new_subformula, node.right) : f_ptr<BinaryType>(node.left, new_subformula)));
+        return f_ptr<QuantifierType>(new_var, quantifier_on_left ? pull_quantifiers<NaryType>(new_subformula, right) : pull_quantifiers<NaryType>(left, new_subformula));
+    } else {
+        return f_ptr<QuantifierType>(quant.var_symbol, quantifier_on_left ? pull_quantifiers<NaryType>(quant.formula, right) : pull_quantifiers<NaryType>(left, quant.formula));
+    }
+}
+
+// Pulls the quantifiers out of the conjuction (disjunction) of two formulas in prenex normal form.
+template <typename NaryType>
+static FormulaRef pull_quantifiers(FormulaRef left, FormulaRef right)
+{
+    // Universal quantifiers over the same variable can be merged over a conjuction, existential ones over a disjunction.
+    using MergeableType = std::conditional_t<std::is_same_v<NaryType, Conjuction>, UniversalQuantification, ExistentialQuantification>;
+    const auto *l = std::get_if<MergeableType>(left.get());
+    const auto *r = std::get_if<MergeableType>(right.get());
+    if (l && r && l->var_symbol == r->var_symbol) {
+        return f_ptr<MergeableType>(l->var_symbol, pull_quantifiers<NaryType>(l->formula, r->formula));
+    }
+
+    if (const auto *uni = std::get_if<UniversalQuantification>(left.get())) {
+        return pull_quantifiers<NaryType, UniversalQuantification>(left, right, *uni, true);
+    } else if (const auto *exi = std::get_if<ExistentialQuantification>(left.get())) {
+        return pull_quantifiers<NaryType, ExistentialQuantification>(left, right, *exi, true);
+    } else if (const auto *uni = std::get_if<UniversalQuantification>(right.get())) {
+        return pull_quantifiers<NaryType, UniversalQuantification>(left, right, *uni, false);
+    } else if (const auto *exi = std::get_if<ExistentialQuantification>(right.get())) {
+        return pull_quantifiers<NaryType, ExistentialQuantification>(left, right, *exi, false);
     } else {
-        return f_ptr<QuantifierType>(quant.var_symbol, pull_quantifiers(quantifier_on_left ? f_ptr<BinaryType>(quant.formula, node.right) : f_ptr<BinaryType>(node.left, quant.formula)));
+        return f_ptr<NaryType>(left, right);
+    }
+}
+
+static bool is_quantified(FormulaRef formula)
+{
+    return std::holds_alternative<UniversalQuantification>(*formula) || std::holds_alternative<ExistentialQuantification>(*formula);
+}
+
+// Brings the operands into prenex normal form, and pulls their quantifiers out one operand at a time.
+// Leading quantifier-free operands are gathered and joined at once, as joining them one at a time
+// would copy all of the operands gathered so far on every step.
+template <typename NaryType>
+static FormulaRef pull_operand_quantifiers(const NaryType &node)
+{
+    std::vector<FormulaRef> quantifier_free;
+    FormulaRef result;
+    for (const auto &operand : node.operands) {
+        const auto normalized = pnf_h(operand);
+        if (result) {
+            result = pull_quantifiers<NaryType>(result, normalized);
+        } else if (!is_quantified(normalized)) {
+            quantifier_free.push_back(normalized);
+        } else if (quantifier_free.empty()) {
+            result = normalized;
+        } else {
+            result = pull_quantifiers<NaryType>(f_ptr<NaryType>(quantifier_free), normalized);
+        }
     }
+    return result ? result : f_ptr<NaryType>(quantifier_free);
 }
 
 template<typename QuantifierType>
-static std::shared_ptr<Formula> pull_quantifiers(const QuantifierType &quant)
+static FormulaRef pull_quantifiers(const QuantifierType &quant)
 {
-    std::set<std::string> quantified_vars;
+    std::set<SymbolId> quantified_vars;
     collect_quantified_variables(quant.formula, quantified_vars);
     if (quantified_vars.contains(quant.var_symbol)) {
         const auto new_var = generate_unique_variable(quant.var_symbol, quantified_vars);
@@ -488,175 +536,477 @@ static std::shared_ptr<Formula> pull_quantifiers(const QuantifierType &quant)
     }
 }
 
-static std::shared_ptr<Formula> pull_quantifiers(std::shared_ptr<Formula> formula)
+static FormulaRef pnf_h(FormulaRef formula)
 {
-    return std::visit(
-        overloaded{
-            [&formula](const AtomWrapper &node) {
-                return formula;
-            },
-            [&formula](const True &node) {
-                return formula;
-            },
-            [&formula](const False &node) {
-                return formula;
-            },
-            [&formula](const Negation &node) {
-                return formula;
-            },
-            [](const Conjuction &node) {
-                if (std::holds_alternative<UniversalQuantification>(*node.left) && std::holds_alternative<UniversalQuantification>(*node.right)) {
-                    const auto l = std::get<UniversalQuantification>(*node.left);
-                    const auto r = std::get<UniversalQuantification>(*node.right);
-                    if (l.var_symbol == r.var_symbol) {
-                        return f_ptr<UniversalQuantification>(l.var_symbol, pull_quantifiers(f_ptr<Conjuction>(l.formula, r.formula)));
-                    }
-                }
-                if (const auto *uni = std::get_if<UniversalQuantification>(node.left.get())) {
-                    return pull_quantifiers<Conjuction, UniversalQuantification>(node, *uni, true);
-                } else if (const auto *exi = std::get_if<ExistentialQuantification>(node.left.get())) {
-                    return pull_quantifiers<Conjuction, ExistentialQuantification>(node, *exi, true);
-                } else if (const auto *uni = std::get_if<UniversalQuantification>(node.right.get())) {
-                    return pull_quantifiers<Conjuction, UniversalQuantification>(node, *uni, false);
-                } else if (const auto *exi = std::get_if<ExistentialQuantification>(node.right.get())) {
-                    return pull_quantifiers<Conjuction, ExistentialQuantification>(node, *exi, false);
-                } else {
-                    return f_ptr<Conjuction>(pull_quantifiers(node.left), pull_quantifiers(node.right));
+    return memoize(formula, CachedPass::PNF, subformula_dependencies, [](FormulaRef formula, CachedPass pass) {
+        return std::visit(
+            overloaded{
+                [&formula](const AtomWrapper &node) {
+                    return formula;
+                },
+                [&formula](const True &node) {
+                    return formula;
+                },
+                [&formula](const False &node) {
+                    return formula;
+                },
+                [&formula](const Negation &node) {
+                    return formula;
+                },
+                [](const Conjuction &node) {
+                    return pull_operand_quantifiers(node);
+                },
+                [](const Disjunction &node) {
+                    return pull_operand_quantifiers(node);
+                },
+                [](const UniversalQuantification &node) {
+                    return pull_quantifiers<UniversalQuantification>(node);
+                },
+                [](const ExistentialQuantification &node) {
+                    return pull_quantifiers<ExistentialQuantification>(node);
+                },
+                [&formula](const auto &node) {
+                    assert(!"Unreachable");
+                    return formula;
                 }
-            },
-            [&formula](const Disjunction &node) {
-                if (std::holds_alternative<ExistentialQuantification>(*node.left) && std::holds_alternative<ExistentialQuantification>(*node.right)) {
-                    const auto l = std::get<ExistentialQuantification>(*node.left);
-                    const auto r = std::get<ExistentialQuantification>(*node.right);
-                    if (l.var_symbol == r.var_symbol) {
-                        return f_ptr<UniversalQuantification>(l.var_symbol, pull_quantifiers(f_ptr<Disjunction>(l.formula, r.formula)));
-                    }
+            }, *formula
+        );
+    });
+}
+
+FormulaRef pnf(FormulaRef formula)
+{
+    TraceSpan span("pnf");
+    return pnf_h(nnf(formula));
+}
+
+// Normalizes the operands of the n-ary node with the pass, and distributes the node over the operands
+// of those which are OuterType nodes - a single cross product, building a node for every way of
+// picking one operand of each of them.
+template <typename OuterType, typename NaryType, typename Pass>
+static FormulaRef distribute(const NaryType &node, Pass pass)
+{
+    std::vector<FormulaRef> normalized;
+    normalized.reserve(node.operands.size());
+    for (const auto &operand : node.operands) {
+        normalized.push_back(pass(operand));
+    }
+
+    std::vector<std::span<const FormulaRef>> choices;
+    for (const auto &operand : normalized) {
+        if (const auto *outer = std::get_if<OuterType>(operand.get())) {
+            choices.push_back(outer->operands);
+        } else {
+            choices.emplace_back(&operand, 1);
+        }
+    }
+
+    std::vector<FormulaRef> results, picked(choices.size());
+    std::vector<std::size_t> positions(choices.size(), 0);
+    while (true) {
+        for (std::size_t i = 0; i < choices.size(); i++) {
+            picked[i] = choices[i][positions[i]];
+        }
+        results.push_back(f_ptr<NaryType>(picked));
+
+        auto i = choices.size();
+        while (i > 0 && ++positions[i - 1] == choices[i - 1].size()) {
+            positions[i - 1] = 0;
+            i--;
+        }
+        if (i == 0) {
+            break;
+        }
+    }
+    return f_ptr<OuterType>(results);
+}
+
+static FormulaRef dnf_h(FormulaRef formula)
+{
+    return memoize(formula, CachedPass::DNF, subformula_dependencies, [](FormulaRef formula, CachedPass pass) {
+        return std::visit(
+            overloaded{
+                [&formula](const AtomWrapper &node) {
+                    return formula;
+                },
+                [&formula](const True &node) {
+                    return formula;
+                },
+                [&formula](const False &node) {
+                    return formula;
+                },
+                [&formula](const Negation &node) {
+                    return formula;
+                },
+                [](const Conjuction &node) {
+                    return distribute<Disjunction>(node, dnf_h);
+                },
+                [](const Disjunction &node) {
+                    return map_operands<Disjunction>(node, dnf_h);
+                },
+                [](const UniversalQuantification &node) {
+                    return f_ptr<UniversalQuantification>(node.var_symbol, dnf_h(node.formula));
+                },
+                [](const ExistentialQuantification &node) {
+                    return f_ptr<ExistentialQuantification>(node.var_symbol, dnf_h(node.formula));
+                },
+                [&formula](const auto &node) {
+                    assert(!"Unreachable");
+                    return formula;
                 }
-                if (const auto *uni = std::get_if<UniversalQuantification>(node.left.get())) {
-                    return pull_quantifiers<Disjunction, UniversalQuantification>(node, *uni, true);
-                } else if (const auto *exi = std::get_if<ExistentialQuantification>(node.left.get())) {
-                    return pull_quantifiers<Disjunction, ExistentialQuantification>(node, *exi, true);
-                } else if (const auto *uni = std::get_if<UniversalQuantification>(node.right.get())) {
-                    return pull_quantifiers<Disjunction, UniversalQuantification>(node, *uni, false);
-                } else if (const auto *exi = std::get_if<ExistentialQuantification>(node.right.get())) {
-                    return pull_quantifiers<Disjunction, ExistentialQuantification>(node, *exi, false);
-                } else {
-                    return f_ptr<Disjunction>(pull_quantifiers(node.left), pull_quantifiers(node.right));
+            }, *formula
+        );
+    });
+}
+
+FormulaRef dnf(FormulaRef formula)
+{
+    TraceSpan span("dnf");
+    return dnf_h(pnf(formula));
+}
+
+static FormulaRef cnf_h(FormulaRef formula)
+{
+    return memoize(formula, CachedPass::CNF, subformula_dependencies, [](FormulaRef formula, CachedPass pass) {
+        return std::visit(
+            overloaded{
+                [&formula](const AtomWrapper &node) {
+                    return formula;
+                },
+                [&formula](const True &node) {
+                    return formula;
+                },
+                [&formula](const False &node) {
+                    return formula;
+                },
+                [&formula](const Negation &node) {
+                    return formula;
+                },
+                [](const Disjunction &node) {
+                    return distribute<Conjuction>(node, cnf_h);
+                },
+                [](const Conjuction &node) {
+                    return map_operands<Conjuction>(node, cnf_h);
+                },
+                [](const UniversalQuantification &node) {
+                    return f_ptr<UniversalQuantification>(node.var_symbol, cnf_h(node.formula));
+                },
+                [](const ExistentialQuantification &node) {
+                    return f_ptr<ExistentialQuantification>(node.var_symbol, cnf_h(node.formula));
+                },
+                [&formula](const auto &node) {
+                    assert(!"Unreachable");
+                    return formula;
                 }
-            },
-            [&formula](const UniversalQuantification &node) {
-                return formula;
-            },
-            [&formula](const ExistentialQuantification &node) {
-                return formula;
-            },
-            [&formula](const auto &node) {
-                assert(!"Unreachable");
-                return formula;
-            }
-        }, *formula
-    );
+            }, *formula
+        );
+    });
 }
 
-static std::shared_ptr<Formula> pnf_h(std::shared_ptr<Formula> formula)
+FormulaRef cnf(FormulaRef formula)
 {
-    return std::visit(
-        overloaded{
-            [&formula](const AtomWrapper &node) {
-                return formula;
-            },
-            [&formula](const True &node) {
-                return formula;
-            },
-            [&formula](const False &node) {
-                return formula;
-            },
-            [&formula](const Negation &node) {
-                return formula;
-            },
-            [](const Conjuction &node) {
-                return pull_quantifiers(f_ptr<Conjuction>(pnf_h(node.left), pnf_h(node.right)));
-            },
-            [](const Disjunction &node) {
-                return pull_quantifiers(f_ptr<Disjunction>(pnf_h(node.left), pnf_h(node.right)));
-            },
-            [](const UniversalQuantification &node) {
-                return pull_quantifiers<UniversalQuantification>(node);
-            },
-            [](const ExistentialQuantification &node) {
-                return pull_quantifiers<ExistentialQuantification>(node);
-            },
-            [&formula](const auto &node) {
-                assert(!"Unreachable");
-                return formula;
-            }
-        }, *formula
-    );
+    TraceSpan span("cnf");
+    return cnf_h(pnf(formula));
 }
 
-std::shared_ptr<Formula> pnf(std::shared_ptr<Formula> formula)
+std::set<SymbolId> free_variables(FormulaRef formula)
 {
-    return pnf_h(nnf(formula));
+    std::set<SymbolId> free_vars;
+    collect_free_variables(formula, free_vars);
+    return free_vars;
 }
 
-static std::shared_ptr<Formula> dnf_h(std::shared_ptr<Formula> formula)
+// Whether var occurs free in the formula, memoized in occurs for the subformulas of every formula asked about.
+static bool occurs_free(SymbolId var, FormulaRef formula, std::unordered_map<FormulaRef, bool> &occurs)
 {
-    return std::visit(
-        overloaded{
-            [&formula](const AtomWrapper &node) {
-                return formula;
-            },
-            [&formula](const True &node) {
-                return formula;
-            },
-            [&formula](const False &node) {
-                return formula;
-            },
-            [&formula](const Negation &node) {
-                return formula;
-            },
-            [&formula](const Conjuction &node) {
-                const auto left = dnf_h(node.left);
-                const auto right = dnf_h(node.right);
-                if (const auto *dis = std::get_if<Disjunction>(left.get())) {
-                    return f_ptr<Disjunction>(
-                        dnf_h(f_ptr<Conjuction>(dis->left, right)),
-                        dnf_h(f_ptr<Conjuction>(dis->right, right))
-                    );
-                } else if (const auto *dis = std::get_if<Disjunction>(right.get())) {
-                    return f_ptr<Disjunction>(
-                        dnf_h(f_ptr<Conjuction>(left, dis->left)),
-                        dnf_h(f_ptr<Conjuction>(left, dis->right))
+    const auto dependencies = [](FormulaRef current, std::vector<FormulaRef> &pending) {
+        for_each_subformula(*current, [&pending](FormulaRef subformula) {
+            pending.push_back(subformula);
+        });
+    };
+    const auto compute = [&var, &occurs](FormulaRef current) {
+        return std::visit(
+            overloaded{
+                [&var](const AtomWrapper &node) {
+                    return std::visit(
+                        [&var](const auto &atom) {
+                            return atom.term->coefficient_of(var) != Fraction{};
+                        }, *node.atom
                     );
-                } else {
-                    return formula;
+                },
+                [&var, &occurs](const UniversalQuantification &node) {
+                    return node.var_symbol != var && occurs.at(node.formula);
+                },
+                [&var, &occurs](const ExistentialQuantification &node) {
+                    return node.var_symbol != var && occurs.at(node.formula);
+                },
+                [&current, &occurs](const auto &node) {
+                    bool is_free = false;
+                    for_each_subformula(*current, [&is_free, &occurs](FormulaRef subformula) {
+                        is_free = is_free || occurs.at(subformula);
+                    });
+                    return is_free;
                 }
-            },
-            [](const Disjunction &node) {
-                return f_ptr<Disjunction>(dnf_h(node.left), dnf_h(node.right));
-            },
-            [](const UniversalQuantification &node) {
-                return f_ptr<UniversalQuantification>(node.var_symbol, dnf_h(node.formula));
-            },
-            [](const ExistentialQuantification &node) {
-                return f_ptr<UniversalQuantification>(node.var_symbol, dnf_h(node.formula));
-            },
-            [&formula](const auto &node) {
-                assert(!"Unreachable");
-                return formula;
+            }, *current
+        );
+    };
+    return memoize_in(occurs, formula, dependencies, compute);
+}
+
+template <typename NaryType>
+static void flatten(FormulaRef formula, std::vector<FormulaRef> &operands)
+{
+    if (const auto *node = std::get_if<NaryType>(formula.get())) {
+        operands.insert(operands.end(), node->operands.begin(), node->operands.end());
+    } else {
+        operands.push_back(formula);
+    }
+}
+
+// Pushes the quantifier over var as deep as possible into the (already miniscoped) formula.
+// DistributiveType is the connective the quantifier distributes over (disjunction for the
+// existential, conjuction for the universal quantifier), while from SplittableType only the
+// operands that don't mention var can be pulled out of the quantifier's scope.
+template <typename QuantifierType, typename DistributiveType, typename SplittableType>
+static FormulaRef push_quantifier(SymbolId var, FormulaRef formula)
+{
+    std::unordered_map<FormulaRef, bool> occurs;
+    const auto is_free_in = [&var, &occurs](FormulaRef formula) {
+        return occurs_free(var, formula, occurs);
+    };
+    // The operands mentioning var and the ones that don't, for the SplittableType formulas that have both.
+    std::unordered_map<FormulaRef, std::pair<FormulaRef, FormulaRef>> splits;
+    std::unordered_map<FormulaRef, FormulaRef> results;
+
+    const auto dependencies = [&is_free_in, &splits](FormulaRef current, std::vector<FormulaRef> &pending) {
+        if (!is_free_in(current)) {
+            return;
+        }
+        if (const auto *node = std::get_if<DistributiveType>(current.get())) {
+            pending.insert(pending.end(), node->operands.begin(), node->operands.end());
+        } else if (std::holds_alternative<SplittableType>(*current)) {
+            std::vector<FormulaRef> operands, dependent, independent;
+            flatten<SplittableType>(current, operands);
+            for (const auto &operand : operands) {
+                (is_free_in(operand) ? dependent : independent).push_back(operand);
             }
-        }, *formula
-    );
+            if (!independent.empty()) {
+                const auto joined = join<SplittableType>(dependent);
+                splits.emplace(current, std::make_pair(joined, join<SplittableType>(independent)));
+                pending.push_back(joined);
+            }
+        }
+    };
+
+    const auto compute = [&var, &is_free_in, &splits, &results](FormulaRef current) {
+        if (!is_free_in(current)) {
+            return current;
+        }
+        if (const auto *node = std::get_if<DistributiveType>(current.get())) {
+            return map_operands<DistributiveType>(*node, [&results](FormulaRef operand) {
+                return results.at(operand);
+            });
+        }
+        if (const auto it = splits.find(current); it != splits.end()) {
+            return f_ptr<SplittableType>(results.at(it->second.first), it->second.second);
+        }
+        return f_ptr<QuantifierType>(var, current);
+    };
+
+    return memoize_in(results, formula, dependencies, compute);
 }
 
-std::shared_ptr<Formula> dnf(std::shared_ptr<Formula> formula)
+// Miniscopes the formula in NNF bottom-up, pushing every quantifier into its already miniscoped body.
+static FormulaRef miniscope_h(FormulaRef formula)
 {
-    return dnf_h(pnf(formula));
+    std::unordered_map<FormulaRef, FormulaRef> results;
+    const auto dependencies = [](FormulaRef current, std::vector<FormulaRef> &pending) {
+        for_each_subformula(*current, [&pending](FormulaRef subformula) {
+            pending.push_back(subformula);
+        });
+    };
+    const auto compute = [&results](FormulaRef current) {
+        const auto result_of = [&results](FormulaRef subformula) {
+            return results.at(subformula);
+        };
+        return std::visit(
+            overloaded{
+                [&result_of](const Conjuction &node) {
+                    return map_operands<Conjuction>(node, result_of);
+                },
+                [&result_of](const Disjunction &node) {
+                    return map_operands<Disjunction>(node, result_of);
+                },
+                [&result_of](const UniversalQuantification &node) {
+                    return push_quantifier<UniversalQuantification, Conjuction, Disjunction>(node.var_symbol, result_of(node.formula));
+                },
+                [&result_of](const ExistentialQuantification &node) {
+                    return push_quantifier<ExistentialQuantification, Disjunction, Conjuction>(node.var_symbol, result_of(node.formula));
+                },
+                [&current](const auto &node) {
+                    return current;
+                }
+            }, *current
+        );
+    };
+    return memoize_in(results, formula, dependencies, compute);
+}
+
+FormulaRef miniscope(FormulaRef formula)
+{
+    TraceSpan span("miniscope");
+    return miniscope_h(nnf(formula));
+}
+
+// Solves term = 0 for var, returning nullptr if var does not occur in it.
+static TermRef solve_for(TermRef term, SymbolId var)
+{
+    const auto coef = term->coefficient_of(var);
+    if (coef == Fraction{}) {
+        return nullptr;
+    }
+    return intern((*term - LinearTerm(coef, var)) * (Fraction(-1) / coef));
+}
+
+static LinearTerm substitute_term(TermRef term, SymbolId var, TermRef s_term)
+{
+    const auto coef = term->coefficient_of(var);
+    return *term - LinearTerm(coef, var) + *s_term * coef;
+}
+
+// Substitutes the term for the free occurrences of var, whose variables are s_term_vars.
+static FormulaRef substitute_term(FormulaRef formula, SymbolId var, TermRef s_term, const std::set<SymbolId> &s_term_vars)
+{
+    return substitute_free(formula, var, s_term_vars, [&var, &s_term](AtomRef atom) {
+        return std::visit(
+            [&var, &s_term](const auto &node) {
+                using AtomType = std::decay_t<decltype(node)>;
+                return a_ptr<AtomType>(substitute_term(node.term, var, s_term), LinearTerm());
+            }, *atom
+        );
+    });
+}
+
+// Returns t if the literal is var = t (or var != t when looking for a disequality).
+static TermRef defining_term(FormulaRef literal, SymbolId var, bool is_equality)
+{
+    bool is_negated = false;
+    if (const auto *negation = std::get_if<Negation>(literal.get())) {
+        literal = negation->operand;
+        is_negated = true;
+    }
+
+    const auto *wrapper = std::get_if<AtomWrapper>(literal.get());
+    if (!wrapper) {
+        return nullptr;
+    }
+    if (const auto *eq = std::get_if<EqualTo>(wrapper->atom.get()); eq && is_negated != is_equality) {
+        return solve_for(eq->term, var);
+    }
+    if (const auto *neq = std::get_if<NotEqualTo>(wrapper->atom.get()); neq && is_negated == is_equality) {
+        return solve_for(neq->term, var);
+    }
+    return nullptr;
+}
+
+// If one of the operands of the SplittableType formula defines var, substitutes the defining
+// term for var in the other operands and drops the defining literal. Returns nullptr otherwise.
+template <typename SplittableType>
+static FormulaRef substitute_defining_literal(SymbolId var, FormulaRef formula, bool is_existential)
+{
+    std::vector<FormulaRef> operands;
+    flatten<SplittableType>(formula, operands);
+    for (std::size_t i = 0; i < operands.size(); i++) {
+        const auto s_term = defining_term(operands[i], var, is_existential);
+        if (!s_term) {
+            continue;
+        }
+
+        std::set<SymbolId> s_term_vars;
+        collect_free_variables(s_term, s_term_vars);
+        operands.erase(operands.begin() + i);
+        if (operands.empty()) {
+            return is_existential ? f_ptr<True>() : f_ptr<False>();
+        }
+        for (auto &operand : operands) {
+            operand = substitute_term(operand, var, s_term, s_term_vars);
+        }
+        return join<SplittableType>(operands);
+    }
+    return nullptr;
+}
+
+// ?x.(x = t & F) <=> F[t/x] and !x.(x != t | F) <=> F[t/x], also applied when every operand of the
+// connective the quantifier distributes over has a defining literal of its own.
+template <typename QuantifierType, typename DistributiveType, typename SplittableType>
+static FormulaRef substitute_defining_equality(SymbolId var, FormulaRef formula)
+{
+    constexpr bool is_existential = std::is_same_v<QuantifierType, ExistentialQuantification>;
+    if (const auto substituted = substitute_defining_literal<SplittableType>(var, formula, is_existential)) {
+        return substituted;
+    }
+
+    if (std::holds_alternative<DistributiveType>(*formula)) {
+        std::vector<FormulaRef> operands;
+        flatten<DistributiveType>(formula, operands);
+        for (auto &operand : operands) {
+            const auto substituted = substitute_defining_literal<SplittableType>(var, operand, is_existential);
+            if (!substituted) {
+                return f_ptr<QuantifierType>(var, formula);
+            }
+            operand = substituted;
+        }
+        return join<DistributiveType>(operands);
+    }
+
+    return f_ptr<QuantifierType>(var, formula);
+}
+
+static FormulaRef substitute_equalities_h(FormulaRef formula)
+{
+    std::unordered_map<FormulaRef, FormulaRef> results;
+    const auto dependencies = [](FormulaRef current, std::vector<FormulaRef> &pending) {
+        for_each_subformula(*current, [&pending](FormulaRef subformula) {
+            pending.push_back(subformula);
+        });
+    };
+    const auto compute = [&results](FormulaRef current) {
+        const auto result_of = [&results](FormulaRef subformula) {
+            return results.at(subformula);
+        };
+        return std::visit(
+            overloaded{
+                [&result_of](const Conjuction &node) {
+                    return map_operands<Conjuction>(node, result_of);
+                },
+                [&result_of](const Disjunction &node) {
+                    return map_operands<Disjunction>(node, result_of);
+                },
+                [&result_of](const UniversalQuantification &node) {
+                    return substitute_defining_equality<UniversalQuantification, Conjuction, Disjunction>(node.var_symbol, result_of(node.formula));
+                },
+                [&result_of](const ExistentialQuantification &node) {
+                    return substitute_defining_equality<ExistentialQuantification, Disjunction, Conjuction>(node.var_symbol, result_of(node.formula));
+                },
+                [&current](const auto &node) {
+                    return current;
+                }
+            }, *current
+        );
+    };
+    return memoize_in(results, formula, dependencies, compute);
+}
+
+FormulaRef substitute_equalities(FormulaRef formula)
+{
+    TraceSpan span("substitute_equalities");
+    return simplify(substitute_equalities_h(nnf(formula)));
 }
 
-std::shared_ptr<Formula> close(std::shared_ptr<Formula> formula)
+FormulaRef close(FormulaRef formula)
 {
-    std::set<std::string> free_vars;
+    TraceSpan span("close");
+    std::set<SymbolId> free_vars;
     collect_free_variables(formula, free_vars);
     auto closed_formula = formula;
     for (const auto &var : free_vars) {
@@ -3,21 +3,37 @@
 
 #include "fol_ast.hpp"
 
-#include <memory>
+#include <set>
 
 // Removes logical constants from the given formula or transforms it to a constant itself.
-std::shared_ptr<Formula> simplify(std::shared_ptr<Formula> formula);
+FormulaRef simplify(FormulaRef formula);
 
 // Converts the given formula to its negation normal form.
-std::shared_ptr<Formula> nnf(std::shared_ptr<Formula> formula);
+FormulaRef nnf(FormulaRef formula);
 
 // Converts the given formula to its prenex normal form.
-std::shared_ptr<Formula> pnf(std::shared_ptr<Formula> formula);
+FormulaRef pnf(FormulaRef formula);
+
+// Converts the given formula to its negation normal form with every quantifier pushed as deep
+// inside as possible (existentials over disjunctions, universals over conjuctions), dropping
+// the quantifiers whose variable doesn't occur in their scope.
+FormulaRef miniscope(FormulaRef formula);
+
+// Converts the given formula to its negation normal form and removes every quantifier whose
+// variable is defined by an equality (x = t for existentials, x != t for universals) in its
+// scope, by substituting the defining term for the variable.
+FormulaRef substitute_equalities(FormulaRef formula);
 
 // Converts the given formula to its disjunctive normal form.
-std::shared_ptr<Formula> dnf(std::shared_ptr<Formula> formula);
+FormulaRef dnf(FormulaRef formula);
+
+// Converts the given formula to its conjunctive normal form.
+FormulaRef cnf(FormulaRef formula);
+
+// Returns the variables which occur free in the given formula.
+std::set<SymbolId> free_variables(FormulaRef formula);
 
 // Converts the given formula to its closed form.
-std::shared_ptr<Formula> close(std::shared_ptr<Formula> formula);
+FormulaRef close(FormulaRef formula);
 
 #endif // FOL_NORMALIZATION_HPP
@@ -1,87 +1,103 @@
 #include "fol_string_conversion.hpp"
 #include "fol_driver.hpp"
+#include "trace.hpp"
 
-static unsigned precedence(std::shared_ptr<Term> term)
+#include <variant>
+#include <vector>
+#include <span>
+#include <string_view>
+#include <ostream>
+
+// A piece of the output - either text, or a node still to be expanded into its pieces. The text
+// is either a literal or an interned symbol, so it outlives the conversion either way.
+using Piece = std::variant<std::string_view, TermRef, AtomRef, FormulaRef>;
+
+template <typename Node>
+static void add_operand(std::vector<Piece> &pieces, Node operand, bool needs_parentheses)
 {
-    return std::visit(
-        overloaded{
-            [](const RationalNumber &node) {
-                return 1;
-            },
-            [](const Variable &node) {
-                return 1;
-            },
-            [](const Addition &node) {
-                return 0;
-            },
-            [](const Subtraction &node) {
-                return 0;
-            }
-        }, *term
-    );
+    if (needs_parentheses) {
+        pieces.push_back("(");
+        pieces.push_back(operand);
+        pieces.push_back(")");
+    } else {
+        pieces.push_back(operand);
+    }
 }
 
-static std::string term_to_string(std::shared_ptr<Term> term)
+// The printer writes either into a string buffer or straight into a stream.
+static void put(std::string &out, std::string_view text)
 {
-    static constexpr auto wrap = [](const auto term, const auto parent) {
-        if (precedence(term) < precedence(parent)) {
-            return "(" + term_to_string(term) + ")";
-        } else {
-            return term_to_string(term);
-        }
+    out += text;
+}
+
+static void put(std::ostream &out, std::string_view text)
+{
+    out.write(text.data(), text.size());
+}
+
+// Terms are leaves of the formula, so they are written out right away.
+template <typename Output>
+static void write(const LinearTerm &term, Output &out)
+{
+    static constexpr auto put_magnitude = [](const Fraction &value, Output &out) {
+        put(out, static_cast<std::string>(value < Fraction{} ? -value : value));
     };
 
-    return std::visit(
-        overloaded{
-            [](const RationalNumber &node) {
-                return static_cast<std::string>(node.value);
-            },
-            [](const Variable &node) {
-                if (node.coef == Fraction(1, 1)) {
-                    return node.symbol;
-                } else if (node.coef == Fraction(-1, 1)) {
-                    return "-" + node.symbol;
-                } else {
-                    return static_cast<std::string>(node.coef) + "*" + node.symbol;
-                }
-            },
-            [&term](const Addition &node) {
-                return wrap(node.left, term) + "+" + wrap(node.right, term);
-            },
-            [&term](const Subtraction &node) {
-                return wrap(node.left, term) + "-" + wrap(node.right, term);
-            }
-        }, *term
-    );
+    for (std::size_t i = 0; i < term.coefs.size(); i++) {
+        const auto &[symbol, coef] = term.coefs[i];
+        if (coef < Fraction{}) {
+            put(out, "-");
+        } else if (i > 0) {
+            put(out, "+");
+        }
+        if (coef != Fraction(1) && coef != Fraction(-1)) {
+            put_magnitude(coef, out);
+            put(out, "*");
+        }
+        put(out, symbol_name(symbol));
+    }
+
+    if (term.coefs.empty()) {
+        put(out, static_cast<std::string>(term.constant));
+    } else if (term.constant != Fraction{}) {
+        put(out, term.constant < Fraction{} ? "-" : "+");
+        put_magnitude(term.constant, out);
+    }
 }
 
-static std::string atomic_formula_to_string(std::shared_ptr<Atom> atom)
+static void expand(AtomRef atom, std::vector<Piece> &pieces)
 {
-    return std::visit(
+    static constexpr auto add = [](std::vector<Piece> &pieces, const auto &node, const char *relation) {
+        pieces.push_back(node.term);
+        pieces.push_back(relation);
+        pieces.push_back("0");
+    };
+
+    std::visit(
         overloaded{
-            [](const EqualTo &node) {
-                return term_to_string(node.left) + "=" + term_to_string(node.right);
+            [&pieces](const EqualTo &node) {
+                add(pieces, node, "=");
             },
-            [](const LessThan &node) {
-                return term_to_string(node.left) + "<" + term_to_string(node.right);
+            [&pieces](const LessThan &node) {
+                add(pieces, node, "<");
             },
-            [](const LessOrEqualTo &node) {
-                return term_to_string(node.left) + "<=" + term_to_string(node.right);
+            [&pieces](const LessOrEqualTo &node) {
+                add(pieces, node, "<=");
             },
-            [](const GreaterThan &node) {
-                return term_to_string(node.left) + ">" + term_to_string(node.right);
+            [&pieces](const GreaterThan &node) {
+                add(pieces, node, ">");
             },
-            [](const GreaterOrEqualTo &node) {
-                return term_to_string(node.left) + ">=" + term_to_string(node.right);
+            [&pieces](const GreaterOrEqualTo &node) {
+                add(pieces, node, ">=");
             },
-            [](const NotEqualTo &node) {
-                return term_to_string(node.left) + "!=" + term_to_string(node.right);
+            [&pieces](const NotEqualTo &node) {
+                add(pieces, node, "!=");
             }
         }, *atom
     );
 }
 
-static unsigned precedence(std::shared_ptr<Formula> formula)
+static unsigned precedence(FormulaRef formula)
 {
     return std::visit(
         overloaded{
@@ -119,54 +135,120 @@ static unsigned precedence(std::shared_ptr<Formula> formula)
     );
 }
 
-std::string formula_to_string(std::shared_ptr<Formula> formula)
+static void expand(FormulaRef formula, std::vector<Piece> &pieces)
 {
-    static constexpr auto wrap = [](const auto formula, const auto parent) {
-        if (precedence(formula) < precedence(parent)) {
-            return "(" + formula_to_string(formula) + ")";
-        } else {
-            return formula_to_string(formula);
+    static constexpr auto add = [](std::vector<Piece> &pieces, const auto operand, const auto parent) {
+        add_operand(pieces, operand, precedence(operand) < precedence(parent));
+    };
+
+    static constexpr auto add_operands = [](std::vector<Piece> &pieces, std::span<const FormulaRef> operands, const auto parent, const char *connective) {
+        for (std::size_t i = 0; i < operands.size(); i++) {
+            if (i > 0) {
+                pieces.push_back(connective);
+            }
+            add(pieces, operands[i], parent);
         }
     };
 
-    return std::visit(
+    std::visit(
         overloaded{
-            [](const AtomWrapper &node) {
-                return atomic_formula_to_string(node.atom);
-            },
-            [](const True &node) {
-                return std::string("T");
-            },
-            [](const False &node) {
-                return std::string("F");
-            },
-            [&formula](const Negation &node) {
-                return "~" + wrap(node.operand, formula);
-            },
-            [&formula](const Conjuction &node) {
-                return wrap(node.left, formula) + " & " + wrap(node.right, formula);
-            },
-            [&formula](const Disjunction &node) {
-                return wrap(node.left, formula) + " | " + wrap(node.right, formula);
-            },
-            [&formula](const Implication &node) {
-                return wrap(node.left, formula) + " => " + wrap(node.right, formula);
-            },
-            [&formula](const Equivalence &node) {
-                return wrap(node.left, formula) + " <=> " + wrap(node.right, formula);
-            },
-            [&formula](const UniversalQuantification &node) {
-                return "!" + node.var_symbol + "." + wrap(node.formula, formula);
-            },
-            [&formula](const ExistentialQuantification &node) {
-                return "?" + node.var_symbol + "." + wrap(node.formula, formula);
+            [&pieces](const AtomWrapper &node) {
+                pieces.push_back(node.atom);
+            },
+            [&pieces](const True &node) {
+                pieces.push_back("T");
+            },
+            [&pieces](const False &node) {
+                pieces.push_back("F");
+            },
+            [&pieces, &formula](const Negation &node) {
+                pieces.push_back("~");
+                add(pieces, node.operand, formula);
+            },
+            [&pieces, &formula](const Conjuction &node) {
+                add_operands(pieces, node.operands, formula, " & ");
+            },
+            [&pieces, &formula](const Disjunction &node) {
+                add_operands(pieces, node.operands, formula, " | ");
+            },
+            [&pieces, &formula](const Implication &node) {
+                add(pieces, node.left, formula);
+                pieces.push_back(" => ");
+                add(pieces, node.right, formula);
+            },
+            [&pieces, &formula](const Equivalence &node) {
+                add(pieces, node.left, formula);
+                pieces.push_back(" <=> ");
+                add(pieces, node.right, formula);
+            },
+            [&pieces, &formula](const UniversalQuantification &node) {
+                pieces.push_back("!");
+                pieces.push_back(std::string_view(symbol_name(node.var_symbol)));
+                pieces.push_back(".");
+                add(pieces, node.formula, formula);
+            },
+            [&pieces, &formula](const ExistentialQuantification &node) {
+                pieces.push_back("?");
+                pieces.push_back(std::string_view(symbol_name(node.var_symbol)));
+                pieces.push_back(".");
+                add(pieces, node.formula, formula);
             }
         }, *formula
     );
 }
 
-std::shared_ptr<Formula> string_to_formula(const std::string &formula)
+// Nodes are expanded into their pieces as they come up, and the text is written out in a single pass.
+// The depth of the formula only grows the stack of pieces, and the output is never copied.
+template <typename Output>
+static void write(FormulaRef formula, Output &out)
+{
+    std::vector<Piece> stack{formula}, pieces;
+    while (!stack.empty()) {
+        const auto piece = stack.back();
+        stack.pop_back();
+        pieces.clear();
+        std::visit(
+            overloaded{
+                [&out](std::string_view text) {
+                    put(out, text);
+                },
+                [&out](TermRef term) {
+                    write(*term, out);
+                },
+                [&pieces](const auto node) {
+                    expand(node, pieces);
+                }
+            }, piece
+        );
+        stack.insert(stack.end(), pieces.rbegin(), pieces.rend());
+    }
+}
+
+void append_formula(std::string &buffer, FormulaRef formula)
+{
+    write(formula, buffer);
+}
+
+std::string formula_to_string(FormulaRef formula)
+{
+    std::string result;
+    write(formula, result);
+    return result;
+}
+
+std::ostream &operator<<(std::ostream &out, FormulaRef formula)
+{
+    // Like any formatted output, nothing is done for a stream that is not good - so a formula
+    // logged to a disabled stream is not even traversed.
+    if (std::ostream::sentry sentry(out); sentry) {
+        write(formula, out);
+    }
+    return out;
+}
+
+FormulaRef string_to_formula(const std::string &formula)
 {
+    TraceSpan span("string_to_formula");
     FOLDriver driver;
     return driver.parse(formula);
 }
@@ -4,10 +4,16 @@
 #include "fol_ast.hpp"
 
 #include <string>
-#include <memory>
+#include <ostream>
 
-std::string formula_to_string(std::shared_ptr<Formula> formula);
+std::string formula_to_string(FormulaRef formula);
 
-std::shared_ptr<Formula> string_to_formula(const std::string &formula);
+// Appends the formula to the end of the buffer, which can be reused across formulas.
+void append_formula(std::string &buffer, FormulaRef formula);
+
+// Writes the formula straight into the stream, in a single pass over it.
+std::ostream &operator<<(std::ostream &out, FormulaRef formula);
+
+FormulaRef string_to_formula(const std::string &formula);
 
 #endif // FOL_STRING_CONVERSION_HPP
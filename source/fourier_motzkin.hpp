@@ -1,10 +1,15 @@
 #ifndef FOURIER_MOTZKIN_HPP
 #define FOURIER_MOTZKIN_HPP
 
+#include "trace.hpp"
+#include "memory_account.hpp"
+#include "deadline.hpp"
+
 #include <vector>
 #include <cstddef>
 #include <stdexcept>
 #include <algorithm>
+#include <map>
 
 template <typename T>
 class ConstraintConjuction;
@@ -16,22 +21,45 @@ class Constraint
 
 public:
     enum class Relation { EQ, LT, GT };
+    // The rows are what the elimination multiplies, so their storage is accounted for.
+    using Coefficients = std::vector<T, CountingAllocator<T, MemorySubsystem::CONSTRAINTS>>;
 
     Constraint(const std::vector<T> &lhs, Relation relation, const T &rhs);
+    Constraint(Coefficients lhs, Relation relation, const T &rhs);
 
-    const std::vector<T>& get_lhs() const;
+    const Coefficients& get_lhs() const;
     Relation get_relation() const;
     const T& get_rhs() const;
 
+    // Checks if all coefficients are zero, i.e. the constraint is of the form 0 REL rhs.
+    bool is_ground() const;
+    // Evaluates a ground constraint.
+    bool evaluate_ground() const;
+
+    // Scales the constraint so that its first non-zero coefficient is 1, flipping the relation if needed.
+    void normalize();
+
+    auto operator<=>(const Constraint &other) const = default;
+    bool operator==(const Constraint &other) const = default;
+
 private:
-    std::vector<T> m_lhs;
+    Coefficients m_lhs;
     Relation m_relation;
     T m_rhs;
 };
 
 template <typename T>
 Constraint<T>::Constraint(const std::vector<T> &lhs, Relation relation, const T &rhs)
-    : m_lhs(lhs)
+    : m_lhs(lhs.cbegin(), lhs.cend())
+    , m_relation(relation)
+    , m_rhs(rhs)
+{
+
+}
+
+template <typename T>
+Constraint<T>::Constraint(Coefficients lhs, Relation relation, const T &rhs)
+    : m_lhs(std::move(lhs))
     , m_relation(relation)
     , m_rhs(rhs)
 {
@@ -39,7 +67,7 @@ Constraint<T>::Constraint(const std::vector<T> &lhs, Relation relation, const T
 }
 
 template <typename T>
-const std::vector<T>& Constraint<T>::get_lhs() const
+const Constraint<T>::Coefficients& Constraint<T>::get_lhs() const
 {
     return m_lhs;
 }
@@ -56,22 +84,82 @@ const T& Constraint<T>::get_rhs() const
     return m_rhs;
 }
 
+template <typename T>
+bool Constraint<T>::is_ground() const
+{
+    return std::all_of(m_lhs.cbegin(), m_lhs.cend(), [](const T &coef) { return coef == T{}; });
+}
+
+template <typename T>
+bool Constraint<T>::evaluate_ground() const
+{
+    switch (m_relation) {
+    case Relation::EQ:
+        return m_rhs == T{};
+    case Relation::LT:
+        return m_rhs > T{};
+    case Relation::GT:
+        return m_rhs < T{};
+    }
+    return false;
+}
+
+template <typename T>
+void Constraint<T>::normalize()
+{
+    const auto pivot = std::find_if(m_lhs.cbegin(), m_lhs.cend(), [](const T &coef) { return coef != T{}; });
+    if (pivot == m_lhs.cend()) {
+        return;
+    }
+
+    const auto scale = *pivot;
+    for (auto &coef : m_lhs) {
+        coef = coef / scale;
+    }
+    m_rhs = m_rhs / scale;
+
+    if (scale < T{}) {
+        if (m_relation == Relation::LT) {
+            m_relation = Relation::GT;
+        } else if (m_relation == Relation::GT) {
+            m_relation = Relation::LT;
+        }
+    }
+}
+
+// What eliminating a variable from a conjuction took - either a single equality to substitute,
+// or every pair of an upper (lt) and a lower (gt) bound on the variable combined into a new row.
+struct EliminationStep
+{
+    bool by_equality = false;
+    std::size_t lt_bounds = 0;
+    std::size_t gt_bounds = 0;
+    std::size_t generated_rows = 0;
+};
+
 template <typename T>
 class ConstraintConjuction
 {
 public:
+    using Constraints = std::vector<Constraint<T>, CountingAllocator<Constraint<T>, MemorySubsystem::CONSTRAINTS>>;
+
     ConstraintConjuction(const std::vector<Constraint<T>> &constraints);
 
     bool is_satisfiable() const;
-    const std::vector<Constraint<T>>& get_constraints() const;
+    const Constraints& get_constraints() const;
 
-    void eliminate_variable(std::size_t var_index);
+    // Cheap infeasibility check - looks only at the bounds that single variable constraints impose on their variable.
+    bool has_conflicting_bounds() const;
+
+    EliminationStep eliminate_variable(std::size_t var_index);
+    // Estimates by how much eliminating the variable would grow the conjuction (negative if it shrinks).
+    std::ptrdiff_t elimination_cost(std::size_t var_index) const;
 
 private:
-    std::vector<Constraint<T>> m_constraints;
+    Constraints m_constraints;
 
-    bool eliminate_variable_by_equality(std::vector<Constraint<T>> &conjuction, std::size_t var_index) const;
-    void eliminate_variable_by_inequality(std::vector<Constraint<T>> &conjuction, std::size_t var_index) const;
+    bool eliminate_variable_by_equality(Constraints &conjuction, std::size_t var_index) const;
+    EliminationStep eliminate_variable_by_inequality(Constraints &conjuction, std::size_t var_index) const;
 };
 
 template <typename T>
@@ -83,7 +171,7 @@ ConstraintConjuction<T>::ConstraintConjuction(const std::vector<Constraint<T>> &
         }
     }
 
-    m_constraints = constraints;
+    m_constraints.assign(constraints.cbegin(), constraints.cend());
 }
 
 template <typename T>
@@ -103,23 +191,69 @@ bool ConstraintConjuction<T>::ConstraintConjuction::is_satisfiable() const
         }
     }
 
-    for (const auto &constraint : conjuction) {
-        if (constraint.m_relation == Constraint<T>::Relation::EQ && constraint.m_rhs != T{}) {
-            return false;
+    return std::all_of(conjuction.cbegin(), conjuction.cend(), [](const Constraint<T> &constraint) {
+        return constraint.evaluate_ground();
+    });
+}
+
+template <typename T>
+bool ConstraintConjuction<T>::has_conflicting_bounds() const
+{
+    if (m_constraints.size() == 0) {
+        return false;
+    }
+
+    struct Bound
+    {
+        bool is_set = false;
+        T value;
+        bool is_strict = false;
+    };
+
+    const auto num_of_vars = m_constraints[0].m_lhs.size();
+    std::vector<Bound> lower(num_of_vars), upper(num_of_vars);
+    const auto tighten = [](Bound &bound, const T &value, bool is_strict, bool is_upper) {
+        if (!bound.is_set || (is_upper ? value < bound.value : value > bound.value)) {
+            bound = Bound{true, value, is_strict};
+        } else if (value == bound.value) {
+            bound.is_strict = bound.is_strict || is_strict;
         }
-        if (constraint.m_relation == Constraint<T>::Relation::LT && constraint.m_rhs <= T{}) {
-            return false;
+    };
+
+    for (const auto &constraint : m_constraints) {
+        const auto non_zero = [](const T &coef) { return coef != T{}; };
+        const auto var_it = std::find_if(constraint.m_lhs.cbegin(), constraint.m_lhs.cend(), non_zero);
+        if (var_it == constraint.m_lhs.cend() || std::find_if(var_it + 1, constraint.m_lhs.cend(), non_zero) != constraint.m_lhs.cend()) {
+            continue;
         }
-        if (constraint.m_relation == Constraint<T>::Relation::GT && constraint.m_rhs >= T{}) {
-            return false;
+
+        const auto var_index = var_it - constraint.m_lhs.cbegin();
+        const auto value = constraint.m_rhs / *var_it;
+        const auto is_upper = (constraint.m_relation == Constraint<T>::Relation::LT) == (*var_it > T{});
+        if (constraint.m_relation == Constraint<T>::Relation::EQ) {
+            tighten(lower[var_index], value, false, false);
+            tighten(upper[var_index], value, false, true);
+        } else if (is_upper) {
+            tighten(upper[var_index], value, true, true);
+        } else {
+            tighten(lower[var_index], value, true, false);
         }
     }
 
-    return true;
+    for (std::size_t i = 0; i < num_of_vars; i++) {
+        if (!lower[i].is_set || !upper[i].is_set) {
+            continue;
+        }
+        if (lower[i].value > upper[i].value || (lower[i].value == upper[i].value && (lower[i].is_strict || upper[i].is_strict))) {
+            return true;
+        }
+    }
+
+    return false;
 }
 
 template <typename T>
-bool ConstraintConjuction<T>::eliminate_variable_by_equality(std::vector<Constraint<T>> &conjuction, std::size_t var_index) const
+bool ConstraintConjuction<T>::eliminate_variable_by_equality(Constraints &conjuction, std::size_t var_index) const
 {
     for (std::size_t i = 0; i < conjuction.size(); i++) {
         if (conjuction[i].m_relation == Constraint<T>::Relation::EQ) {
@@ -150,7 +284,7 @@ bool ConstraintConjuction<T>::eliminate_variable_by_equality(std::vector<Constra
 }
 
 template <typename T>
-void ConstraintConjuction<T>::eliminate_variable_by_inequality(std::vector<Constraint<T>> &conjuction, std::size_t var_index) const
+EliminationStep ConstraintConjuction<T>::eliminate_variable_by_inequality(Constraints &conjuction, std::size_t var_index) const
 {
     std::vector<std::size_t> lt_inequalities, gt_inequalities;
     for (std::size_t i = 0; i < conjuction.size(); i++) {
@@ -176,7 +310,7 @@ void ConstraintConjuction<T>::eliminate_variable_by_inequality(std::vector<Const
 
     for (const auto lt_idx : lt_inequalities) {
         for (const auto gt_idx : gt_inequalities) {
-            std::vector<T> new_ineq_lhs(conjuction[gt_idx].m_lhs.size());
+            typename Constraint<T>::Coefficients new_ineq_lhs(conjuction[gt_idx].m_lhs.size());
             T new_ineq_rhs;
 
             for (std::size_t k = 0; k < new_ineq_lhs.size(); k++) {
@@ -185,8 +319,9 @@ void ConstraintConjuction<T>::eliminate_variable_by_inequality(std::vector<Const
             new_ineq_rhs = conjuction[lt_idx].m_rhs / conjuction[lt_idx].m_lhs[var_index] - conjuction[gt_idx].m_rhs / conjuction[gt_idx].m_lhs[var_index];
 
             conjuction.push_back(Constraint<T>{
-               new_ineq_lhs, Constraint<T>::Relation::LT, new_ineq_rhs
+               std::move(new_ineq_lhs), Constraint<T>::Relation::LT, new_ineq_rhs
             });
+            check_deadline();
         }
     }
 
@@ -195,20 +330,186 @@ void ConstraintConjuction<T>::eliminate_variable_by_inequality(std::vector<Const
     for (auto it = to_remove.rbegin(); it != to_remove.rend(); it++) {
         conjuction.erase(conjuction.cbegin() + *it);
     }
+
+    return EliminationStep{false, lt_inequalities.size(), gt_inequalities.size(), lt_inequalities.size() * gt_inequalities.size()};
 }
 
 template <typename T>
-const std::vector<Constraint<T>>& ConstraintConjuction<T>::get_constraints() const
+const ConstraintConjuction<T>::Constraints& ConstraintConjuction<T>::get_constraints() const
 {
     return m_constraints;
 }
 
 template <typename T>
-void ConstraintConjuction<T>::eliminate_variable(std::size_t var_index)
+EliminationStep ConstraintConjuction<T>::eliminate_variable(std::size_t var_index)
+{
+    TraceSpan span("ConstraintConjuction::eliminate_variable");
+    if (eliminate_variable_by_equality(m_constraints, var_index)) {
+        return EliminationStep{true};
+    }
+    return eliminate_variable_by_inequality(m_constraints, var_index);
+}
+
+template <typename T>
+std::ptrdiff_t ConstraintConjuction<T>::elimination_cost(std::size_t var_index) const
+{
+    std::ptrdiff_t lt_count = 0, gt_count = 0;
+    for (const auto &constraint : m_constraints) {
+        const auto coef = constraint.m_lhs[var_index];
+        if (coef == T{}) {
+            continue;
+        }
+
+        if (constraint.m_relation == Constraint<T>::Relation::EQ) {
+            // Elimination by equality only removes the equality itself.
+            return -1;
+        } else if ((constraint.m_relation == Constraint<T>::Relation::LT) == (coef > T{})) {
+            lt_count++;
+        } else {
+            gt_count++;
+        }
+    }
+
+    return lt_count * gt_count - lt_count - gt_count;
+}
+
+// Checks if a sorted run of normalized constraints sharing the same left hand side can be satisfied at once.
+template <typename T>
+bool is_consistent_group(const std::vector<const Constraint<T>*> &group)
 {
-    if (!eliminate_variable_by_equality(m_constraints, var_index)) {
-        eliminate_variable_by_inequality(m_constraints, var_index);
+    const T *eq_value = nullptr, *lt_bound = nullptr, *gt_bound = nullptr;
+    for (const auto *constraint : group) {
+        const auto &rhs = constraint->get_rhs();
+        switch (constraint->get_relation()) {
+        case Constraint<T>::Relation::EQ:
+            if (eq_value && *eq_value != rhs) {
+                return false;
+            }
+            eq_value = &rhs;
+            break;
+        case Constraint<T>::Relation::LT:
+            if (!lt_bound || rhs < *lt_bound) {
+                lt_bound = &rhs;
+            }
+            break;
+        case Constraint<T>::Relation::GT:
+            if (!gt_bound || rhs > *gt_bound) {
+                gt_bound = &rhs;
+            }
+            break;
+        }
+    }
+
+    if (eq_value && lt_bound && *eq_value >= *lt_bound) {
+        return false;
+    }
+    if (eq_value && gt_bound && *eq_value <= *gt_bound) {
+        return false;
+    }
+    if (lt_bound && gt_bound && *gt_bound >= *lt_bound) {
+        return false;
+    }
+    return true;
+}
+
+// Normalizes a disjunction of constraint conjuctions (cubes): every cube becomes a sorted set of
+// canonical constraints, and duplicate, subsumed and directly contradictory cubes are removed.
+// Ground constraints are evaluated on the spot - true ones are dropped, false ones drop their cube.
+template <typename T>
+void normalize_disjunction(std::vector<ConstraintConjuction<T>> &disjunction)
+{
+    // Canonical constraints are numbered in their sorted order, so that a sorted set of ids
+    // keeps the constraints sharing the same left hand side next to each other.
+    std::map<Constraint<T>, std::size_t> atom_ids;
+    for (const auto &conjuction : disjunction) {
+        for (auto constraint : conjuction.get_constraints()) {
+            if (constraint.is_ground()) {
+                continue;
+            }
+            constraint.normalize();
+            atom_ids.emplace(std::move(constraint), 0);
+            check_deadline();
+        }
+    }
+    std::vector<const Constraint<T>*> atoms;
+    atoms.reserve(atom_ids.size());
+    for (auto &[atom, id] : atom_ids) {
+        id = atoms.size();
+        atoms.push_back(&atom);
+    }
+
+    std::vector<std::vector<std::size_t>> cubes;
+    cubes.reserve(disjunction.size());
+    std::vector<bool> keep(disjunction.size(), true);
+    for (const auto &conjuction : disjunction) {
+        std::vector<std::size_t> cube;
+        cube.reserve(conjuction.get_constraints().size());
+        for (auto constraint : conjuction.get_constraints()) {
+            if (constraint.is_ground()) {
+                if (!constraint.evaluate_ground()) {
+                    keep[cubes.size()] = false;
+                }
+                continue;
+            }
+            constraint.normalize();
+            cube.push_back(atom_ids.find(constraint)->second);
+            check_deadline();
+        }
+        std::sort(cube.begin(), cube.end());
+        cube.erase(std::unique(cube.begin(), cube.end()), cube.end());
+        cubes.push_back(std::move(cube));
+    }
+
+    for (std::size_t i = 0; i < cubes.size(); i++) {
+        std::vector<const Constraint<T>*> group;
+        for (std::size_t j = 0; j < cubes[i].size() && keep[i]; j++) {
+            const auto *atom = atoms[cubes[i][j]];
+            if (!group.empty() && group.back()->get_lhs() != atom->get_lhs()) {
+                keep[i] = is_consistent_group(group);
+                group.clear();
+            }
+            group.push_back(atom);
+        }
+        keep[i] = keep[i] && is_consistent_group(group);
+    }
+
+    // Smaller cubes go first, so each cube only has to be checked against the already kept ones.
+    std::vector<std::size_t> order;
+    for (std::size_t i = 0; i < cubes.size(); i++) {
+        if (keep[i]) {
+            order.push_back(i);
+        }
+    }
+    std::stable_sort(order.begin(), order.end(), [&cubes](std::size_t l, std::size_t r) {
+        return cubes[l].size() < cubes[r].size();
+    });
+    std::vector<std::size_t> kept;
+    for (const auto i : order) {
+        const auto is_subsumed = std::any_of(kept.cbegin(), kept.cend(), [&cubes, i](std::size_t k) {
+            check_deadline();
+            return std::includes(cubes[i].cbegin(), cubes[i].cend(), cubes[k].cbegin(), cubes[k].cend());
+        });
+        if (is_subsumed) {
+            keep[i] = false;
+        } else {
+            kept.push_back(i);
+        }
+    }
+
+    std::vector<ConstraintConjuction<T>> normalized;
+    normalized.reserve(kept.size());
+    for (std::size_t i = 0; i < cubes.size(); i++) {
+        if (!keep[i]) {
+            continue;
+        }
+        std::vector<Constraint<T>> constraints;
+        constraints.reserve(cubes[i].size());
+        for (const auto id : cubes[i]) {
+            constraints.push_back(*atoms[id]);
+        }
+        normalized.emplace_back(constraints);
     }
+    disjunction = std::move(normalized);
 }
 
 #endif // FOURIER_MOTZKIN_HPP
@@ -0,0 +1,108 @@
+#include "fourier_motzkin_c.h"
+#include "theorem_prover.hpp"
+#include "fourier_motzkin.hpp"
+#include "deadline.hpp"
+
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+static thread_local std::string last_error;
+
+static fm_status fail(fm_status status, const char *message)
+{
+    last_error = message;
+    return status;
+}
+
+// Runs the call, turning the exceptions it throws into statuses.
+template <typename Call>
+static fm_status guarded(Call call)
+{
+    try {
+        call();
+        last_error.clear();
+        return FM_OK;
+    } catch (const TimeLimitExceeded &error) {
+        return fail(FM_TIMEOUT, error.what());
+    } catch (const MemoryLimitExceeded &error) {
+        return fail(FM_OUT_OF_MEMORY, error.what());
+    } catch (const std::invalid_argument &error) {
+        return fail(FM_INVALID_ARGUMENT, error.what());
+    } catch (const std::bad_alloc &error) {
+        return fail(FM_OUT_OF_MEMORY, error.what());
+    } catch (const std::exception &error) {
+        return fail(FM_ERROR, error.what());
+    } catch (...) {
+        return fail(FM_ERROR, "Unknown error");
+    }
+}
+
+static TheoremProver make_prover(const fm_limits *limits)
+{
+    return limits ? TheoremProver(true, limits->memory_limit_bytes, std::chrono::milliseconds(limits->time_limit_ms)) : TheoremProver();
+}
+
+fm_status fm_prove(const char *formula, const fm_limits *limits, int *is_theorem)
+{
+    if (!formula || !is_theorem) {
+        return fail(FM_INVALID_ARGUMENT, "The formula and the result must not be null");
+    }
+    return guarded([&] {
+        *is_theorem = make_prover(limits).is_theorem(formula);
+    });
+}
+
+fm_status fm_project(const char *formula, const char *const *variables, size_t variable_count, const fm_limits *limits, char **result)
+{
+    if (!formula || (!variables && variable_count > 0) || !result) {
+        return fail(FM_INVALID_ARGUMENT, "The formula, the variables and the result must not be null");
+    }
+    return guarded([&] {
+        const auto projection = make_prover(limits).project(formula, std::vector<std::string>(variables, variables + variable_count));
+        *result = static_cast<char*>(std::malloc(projection.size() + 1));
+        if (!*result) {
+            throw std::bad_alloc();
+        }
+        std::memcpy(*result, projection.c_str(), projection.size() + 1);
+    });
+}
+
+fm_status fm_sat(size_t constraint_count, size_t variable_count, const int *coefficients, const fm_relation *relations, const int *constants, const fm_limits *limits, int *is_satisfiable)
+{
+    if ((constraint_count > 0 && (!relations || !constants || (variable_count > 0 && !coefficients))) || !is_satisfiable) {
+        return fail(FM_INVALID_ARGUMENT, "The constraints and the result must not be null");
+    }
+    return guarded([&] {
+        MemoryAccount memory(limits ? limits->memory_limit_bytes : 0);
+        MemoryAccountScope memory_scope(memory);
+        DeadlineScope deadline_scope(std::chrono::milliseconds(limits ? limits->time_limit_ms : 0));
+
+        std::vector<Constraint<Fraction>> constraints;
+        constraints.reserve(constraint_count);
+        for (size_t i = 0; i < constraint_count; i++) {
+            Constraint<Fraction>::Coefficients lhs(variable_count);
+            for (size_t k = 0; k < variable_count; k++) {
+                lhs[k] = Fraction(coefficients[i * variable_count + k]);
+            }
+            const auto relation = relations[i] == FM_LT ? Constraint<Fraction>::Relation::LT
+                : relations[i] == FM_EQ ? Constraint<Fraction>::Relation::EQ
+                : relations[i] == FM_GT ? Constraint<Fraction>::Relation::GT
+                : throw std::invalid_argument("Unknown relation of constraint " + std::to_string(i));
+            constraints.emplace_back(std::move(lhs), relation, Fraction(constants[i]));
+        }
+        *is_satisfiable = ConstraintConjuction<Fraction>(constraints).is_satisfiable();
+    });
+}
+
+void fm_free(char *string)
+{
+    std::free(string);
+}
+
+const char *fm_last_error(void)
+{
+    return last_error.c_str();
+}
@@ -0,0 +1,60 @@
+#ifndef FOURIER_MOTZKIN_C_H
+#define FOURIER_MOTZKIN_C_H
+
+#include <stddef.h>
+
+/* C interface to the prover. No function throws; each one returns a status, and on failure the
+ * message of the error can be read with fm_last_error on the same thread. All functions are safe
+ * to call from several threads at once. */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum fm_status
+{
+    FM_OK = 0,
+    /* The formula could not be parsed or the arguments are invalid. */
+    FM_INVALID_ARGUMENT,
+    FM_TIMEOUT,
+    FM_OUT_OF_MEMORY,
+    FM_ERROR
+} fm_status;
+
+/* Limits on a single call, 0 for none. A null pointer to the limits means no limits. */
+typedef struct fm_limits
+{
+    size_t memory_limit_bytes;
+    unsigned long time_limit_ms;
+} fm_limits;
+
+typedef enum fm_relation
+{
+    FM_LT,
+    FM_EQ,
+    FM_GT
+} fm_relation;
+
+/* Decides if the formula is a theorem in the rational numbers, setting is_theorem to 1 or 0. */
+fm_status fm_prove(const char *formula, const fm_limits *limits, int *is_theorem);
+
+/* Eliminates the given variables from the formula, as if they were existentially quantified, and sets
+ * result to the equivalent quantifier free formula. The result must be freed with fm_free. */
+fm_status fm_project(const char *formula, const char *const *variables, size_t variable_count, const fm_limits *limits, char **result);
+
+/* Decides if the system of the given constraints over the given variables has a rational solution,
+ * setting is_satisfiable to 1 or 0. The constraint i is
+ *   coefficients[i * variable_count] x_0 + ... + coefficients[i * variable_count + variable_count - 1] x_(n-1) relations[i] constants[i]. */
+fm_status fm_sat(size_t constraint_count, size_t variable_count, const int *coefficients, const fm_relation *relations, const int *constants, const fm_limits *limits, int *is_satisfiable);
+
+/* Frees a string returned by the functions above. */
+void fm_free(char *string);
+
+/* Returns the message of the last error on the calling thread, valid until the next call on it. */
+const char *fm_last_error(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FOURIER_MOTZKIN_C_H */
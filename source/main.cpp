@@ -1,16 +1,213 @@
 #include "theorem_prover.hpp"
+#include "trace.hpp"
+#include "batch.hpp"
+#include "server.hpp"
+#include "deadline.hpp"
+#include "result_cache.hpp"
 
 #include <string>
+#include <string_view>
 #include <iostream>
+#include <fstream>
+#include <memory>
+#include <thread>
+#include <stop_token>
+#include <ctime>
 
-int main(int argc, char *argv[])
+#include <signal.h>
+#include <pthread.h>
+
+static bool parse_log_level(std::string_view name, LogLevel &level)
+{
+    if (name == "off") {
+        level = LogLevel::OFF;
+    } else if (name == "summary") {
+        level = LogLevel::SUMMARY;
+    } else if (name == "variables") {
+        level = LogLevel::VARIABLES;
+    } else if (name == "trace") {
+        level = LogLevel::TRACE;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Proves the single formula of the input, returning the exit code.
+static int prove(LogLevel log_level, bool print_stats, std::size_t memory_limit, std::chrono::milliseconds time_limit, ResultCache *cache)
 {
-    TheoremProver prover(std::cout);
+    TheoremProver prover(std::cout, log_level, true, memory_limit, time_limit, cache);
 
     std::string formula;
     std::getline(std::cin, formula);
 
-    prover.is_theorem(formula);
+    ProofStats stats;
+    bool result;
+    try {
+        result = prover.is_theorem(formula, print_stats ? &stats : nullptr);
+    } catch (const MemoryLimitExceeded &error) {
+        std::cerr << error.what() << std::endl;
+        return 2;
+    } catch (const TimeLimitExceeded &error) {
+        std::cerr << error.what() << std::endl;
+        return 2;
+    }
+    if (log_level == LogLevel::OFF) {
+        std::cout << (result ? "Formula is a theorem" : "Formula is not a theorem") << std::endl;
+    }
+    if (print_stats) {
+        write_json(std::cout, stats);
+        std::cout << std::endl;
+    }
+    return 0;
+}
+
+// Proves the formulas of the input in batch mode, returning the exit code.
+static int run_batch(const char *input_file, const BatchOptions &options)
+{
+    std::size_t failed;
+    if (input_file) {
+        std::ifstream in(input_file);
+        if (!in) {
+            std::cerr << "Could not read the formulas from \"" << input_file << "\"" << std::endl;
+            return 1;
+        }
+        failed = prove_batch(in, std::cout, options);
+    } else {
+        failed = prove_batch(std::cin, std::cout, options);
+    }
+    return failed > 0 ? 2 : 0;
+}
 
+// Serves the proofs until the process is interrupted or terminated, returning the exit code.
+static int run_server(const char *socket_path, const ServerOptions &options)
+{
+    // The signals are blocked in every thread, and only taken by the one waiting for them, which then
+    // stops the server.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    std::stop_source stop;
+    std::jthread signal_waiter([&signals, &stop](std::stop_token waiter_stop) {
+        const timespec timeout{0, 100'000'000};
+        while (!waiter_stop.stop_requested()) {
+            if (sigtimedwait(&signals, nullptr, &timeout) > 0) {
+                stop.request_stop();
+                return;
+            }
+        }
+    });
+
+    try {
+        serve(socket_path, options, stop.get_token());
+    } catch (const std::exception &error) {
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
     return 0;
 }
+
+// The arguments are the level of detail of the log (off, summary, variables or trace), --stats to
+// write the statistics of the proof as JSON after it, and --trace followed by a file to write
+// a timeline of the proof to, in the Chrome trace event format, and --memory-limit followed by the
+// number of megabytes and --time-limit followed by the number of milliseconds the proof may take
+// before it is aborted.
+//
+// With --batch, every line of the input (or of the file following --input) is proved as a formula,
+// with --jobs followed by the number of them proved in parallel, and --order followed by input or
+// completion as the order the results are written in. With --serve followed by a path, the proofs
+// are served on a Unix domain socket at that path instead, until the process is interrupted, with
+// --max-connections followed by the number of connections handled at once (64 by default) and
+// --idle-timeout followed by the number of seconds a connection may stay idle (300 by default, 0 for
+// no limit). The log level is ignored in both modes.
+//
+// With --cache followed by a file, the results are cached in that file, which is created with room
+// for the number of megabytes following --cache-size (64 by default) if it doesn't exist yet.
+int main(int argc, char *argv[])
+{
+    auto log_level = LogLevel::TRACE;
+    bool print_stats = false;
+    const char *trace_file = nullptr;
+    std::size_t memory_limit = 0;
+    std::chrono::milliseconds time_limit{};
+    bool batch = false;
+    const char *input_file = nullptr;
+    const char *socket_path = nullptr;
+    std::size_t max_connections = ServerOptions{}.max_connections;
+    auto idle_timeout = ServerOptions{}.idle_timeout;
+    BatchOptions batch_options;
+    const char *cache_file = nullptr;
+    std::size_t cache_size = std::size_t{64} << 20;
+    for (int i = 1; i < argc; i++) {
+        const std::string_view argument = argv[i];
+        if (argument == "--stats") {
+            print_stats = true;
+        } else if (argument == "--trace" && i + 1 < argc) {
+            trace_file = argv[++i];
+        } else if (argument == "--memory-limit" && i + 1 < argc) {
+            memory_limit = std::stoull(argv[++i]) << 20;
+        } else if (argument == "--time-limit" && i + 1 < argc) {
+            time_limit = std::chrono::milliseconds(std::stoull(argv[++i]));
+        } else if (argument == "--cache" && i + 1 < argc) {
+            cache_file = argv[++i];
+        } else if (argument == "--cache-size" && i + 1 < argc) {
+            cache_size = std::stoull(argv[++i]) << 20;
+        } else if (argument == "--batch") {
+            batch = true;
+        } else if (argument == "--serve" && i + 1 < argc) {
+            socket_path = argv[++i];
+        } else if (argument == "--max-connections" && i + 1 < argc) {
+            max_connections = std::stoul(argv[++i]);
+        } else if (argument == "--idle-timeout" && i + 1 < argc) {
+            idle_timeout = std::chrono::seconds(std::stoull(argv[++i]));
+        } else if (argument == "--input" && i + 1 < argc) {
+            input_file = argv[++i];
+        } else if (argument == "--jobs" && i + 1 < argc) {
+            batch_options.jobs = std::stoul(argv[++i]);
+        } else if (argument == "--order" && i + 1 < argc && (std::string_view(argv[i + 1]) == "input" || std::string_view(argv[i + 1]) == "completion")) {
+            batch_options.order = std::string_view(argv[++i]) == "input" ? BatchOrder::INPUT : BatchOrder::COMPLETION;
+        } else if (!parse_log_level(argument, log_level)) {
+            std::cerr << "Unknown argument \"" << argument << "\" - expected a log level (off, summary, variables or trace), --stats, --trace <file>, --memory-limit <megabytes>, --time-limit <milliseconds>, --batch, --input <file>, --jobs <count>, --order <input|completion>, --serve <socket>, --max-connections <count>, --idle-timeout <seconds>, --cache <file> or --cache-size <megabytes>" << std::endl;
+            return 1;
+        }
+    }
+
+    std::unique_ptr<ResultCache> cache;
+    if (cache_file) {
+        try {
+            cache = std::make_unique<ResultCache>(cache_file, cache_size);
+        } catch (const std::exception &error) {
+            std::cerr << error.what() << std::endl;
+            return 1;
+        }
+    }
+
+    if (trace_file) {
+        start_tracing();
+    }
+    int exit_code = 0;
+    if (socket_path) {
+        exit_code = run_server(socket_path, ServerOptions{memory_limit, time_limit, print_stats, cache.get(), max_connections, idle_timeout});
+    } else if (batch) {
+        batch_options.memory_limit = memory_limit;
+        batch_options.time_limit = time_limit;
+        batch_options.stats = print_stats;
+        batch_options.cache = cache.get();
+        exit_code = run_batch(input_file, batch_options);
+    } else {
+        exit_code = prove(log_level, print_stats, memory_limit, time_limit, cache.get());
+    }
+    if (trace_file) {
+        stop_tracing();
+        std::ofstream trace_out(trace_file);
+        write_trace(trace_out);
+        if (!trace_out) {
+            std::cerr << "Could not write the trace to \"" << trace_file << "\"" << std::endl;
+            return 1;
+        }
+    }
+
+    return exit_code;
+}
@@ -0,0 +1,54 @@
+#include "memory_account.hpp"
+
+#include <string>
+#include <algorithm>
+
+const char *subsystem_name(MemorySubsystem subsystem)
+{
+    switch (subsystem) {
+    case MemorySubsystem::AST:
+        return "ast";
+    case MemorySubsystem::CUBES:
+        return "cubes";
+    case MemorySubsystem::CONSTRAINTS:
+        return "constraints";
+    default:
+        return "unknown";
+    }
+}
+
+MemoryAccount::MemoryAccount(std::size_t limit)
+    : m_limit(limit)
+{
+
+}
+
+void MemoryAccount::allocate(MemorySubsystem subsystem, std::size_t bytes)
+{
+    if (m_limit != 0 && m_total + bytes > m_limit) {
+        // Tells which subsystem ran out, and what the others were holding at the time.
+        std::string message = "Memory limit of " + std::to_string(m_limit) + " bytes exceeded by an allocation of "
+            + std::to_string(bytes) + " bytes for " + subsystem_name(subsystem) + " (live:";
+        for (std::size_t i = 0; i < m_usage.live.size(); i++) {
+            message += std::string(" ") + subsystem_name(static_cast<MemorySubsystem>(i)) + " " + std::to_string(m_usage.live[i]);
+        }
+        throw MemoryLimitExceeded(message + ")");
+    }
+
+    const auto index = static_cast<std::size_t>(subsystem);
+    m_usage.live[index] += bytes;
+    m_usage.peak[index] = std::max(m_usage.peak[index], m_usage.live[index]);
+    m_total += bytes;
+    m_usage.total_peak = std::max(m_usage.total_peak, m_total);
+}
+
+void MemoryAccount::release(MemorySubsystem subsystem, std::size_t bytes)
+{
+    m_usage.live[static_cast<std::size_t>(subsystem)] -= bytes;
+    m_total -= bytes;
+}
+
+const MemoryUsage &MemoryAccount::usage() const
+{
+    return m_usage;
+}
@@ -0,0 +1,157 @@
+#ifndef MEMORY_ACCOUNT_HPP
+#define MEMORY_ACCOUNT_HPP
+
+#include <array>
+#include <memory>
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
+
+// Parts of a proof whose memory is accounted for separately.
+enum class MemorySubsystem
+{
+    // Nodes of the formulas, with their operand lists and hash tables.
+    AST,
+    // Cubes of the DNFs the variables are eliminated from.
+    CUBES,
+    // Constraint rows of the Fourier-Motzkin elimination.
+    CONSTRAINTS,
+    COUNT
+};
+
+const char *subsystem_name(MemorySubsystem subsystem);
+
+struct MemoryUsage
+{
+    std::array<std::size_t, static_cast<std::size_t>(MemorySubsystem::COUNT)> live{};
+    std::array<std::size_t, static_cast<std::size_t>(MemorySubsystem::COUNT)> peak{};
+    // Peak of the bytes held by all the subsystems together.
+    std::size_t total_peak = 0;
+};
+
+// Thrown when an allocation would take a proof over its memory limit. The allocation is not made.
+class MemoryLimitExceeded : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// Keeps count of the bytes the subsystems of a proof hold, and enforces an optional limit on their
+// total (0 for none). An account belongs to a single proof, and so to a single thread.
+class MemoryAccount
+{
+public:
+    explicit MemoryAccount(std::size_t limit = 0);
+
+    void allocate(MemorySubsystem subsystem, std::size_t bytes);
+    void release(MemorySubsystem subsystem, std::size_t bytes);
+
+    const MemoryUsage &usage() const;
+
+private:
+    std::size_t m_limit;
+    std::size_t m_total = 0;
+    MemoryUsage m_usage;
+};
+
+// The account the memory allocated by this thread is charged to, if any.
+inline thread_local MemoryAccount *active_memory_account = nullptr;
+
+// Makes the given account the active one for its lifetime.
+class MemoryAccountScope
+{
+public:
+    explicit MemoryAccountScope(MemoryAccount &account) : m_previous(active_memory_account) { active_memory_account = &account; }
+    ~MemoryAccountScope() { active_memory_account = m_previous; }
+
+    MemoryAccountScope(const MemoryAccountScope &) = delete;
+    MemoryAccountScope &operator=(const MemoryAccountScope &) = delete;
+
+private:
+    MemoryAccount *m_previous;
+};
+
+// The bytes held by a single owner, charged to the account active when the owner was created and
+// released all at once when it is destroyed. For owners that manage their own storage, like the arena.
+class MemoryCharge
+{
+public:
+    explicit MemoryCharge(MemorySubsystem subsystem) : m_account(active_memory_account), m_subsystem(subsystem) {}
+    ~MemoryCharge() { update(0); }
+
+    MemoryCharge(const MemoryCharge &) = delete;
+    MemoryCharge &operator=(const MemoryCharge &) = delete;
+
+    // Charges or releases the difference to the bytes held so far.
+    void update(std::size_t bytes)
+    {
+        if (!m_account) {
+            return;
+        }
+        if (bytes > m_bytes) {
+            m_account->allocate(m_subsystem, bytes - m_bytes);
+        } else {
+            m_account->release(m_subsystem, m_bytes - bytes);
+        }
+        m_bytes = bytes;
+    }
+
+private:
+    MemoryAccount *m_account;
+    MemorySubsystem m_subsystem;
+    std::size_t m_bytes = 0;
+};
+
+// Charges the storage of a container to the account active when the container was created. The
+// account is charged before the memory is allocated, so a limit is enforced before it is exceeded.
+template <typename T, MemorySubsystem Subsystem>
+class CountingAllocator
+{
+public:
+    using value_type = T;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    template <typename U>
+    struct rebind
+    {
+        using other = CountingAllocator<U, Subsystem>;
+    };
+
+    CountingAllocator() noexcept : m_account(active_memory_account) {}
+
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U, Subsystem> &other) noexcept : m_account(other.account()) {}
+
+    T *allocate(std::size_t n)
+    {
+        if (m_account) {
+            m_account->allocate(Subsystem, n * sizeof(T));
+        }
+        try {
+            return std::allocator<T>().allocate(n);
+        } catch (...) {
+            deallocate(nullptr, n);
+            throw;
+        }
+    }
+
+    void deallocate(T *pointer, std::size_t n) noexcept
+    {
+        if (pointer) {
+            std::allocator<T>().deallocate(pointer, n);
+        }
+        if (m_account) {
+            m_account->release(Subsystem, n * sizeof(T));
+        }
+    }
+
+    MemoryAccount *account() const noexcept { return m_account; }
+
+    bool operator==(const CountingAllocator &other) const noexcept = default;
+
+private:
+    MemoryAccount *m_account;
+};
+
+#endif // MEMORY_ACCOUNT_HPP
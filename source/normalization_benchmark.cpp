@@ -0,0 +1,120 @@
+#include "fol_ast.hpp"
+#include "fol_normalization.hpp"
+#include "fol_string_conversion.hpp"
+#include "quantifier_free.hpp"
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+// Compares the per-node cost of the normalization passes, and of the walks over the quantifier free
+// formulas the prover ends up with, over shallow and deep formulas with the same number of atoms. The
+// passes work with explicit stacks, so the two should be on par. DNF and CNF are left out, as the size
+// of their result already depends on the shape of the formula.
+
+using Leaf = FormulaRef (*)(unsigned index);
+
+static FormulaRef atom(unsigned index)
+{
+    return f_ptr<AtomWrapper>(a_ptr<LessThan>(LinearTerm(Fraction(1), intern_symbol("x" + std::to_string(index))), LinearTerm(Fraction(index))));
+}
+
+// An atom without variables, for the evaluation.
+static FormulaRef ground_atom(unsigned index)
+{
+    return f_ptr<AtomWrapper>(a_ptr<LessThan>(LinearTerm(Fraction(index % 3)), LinearTerm(Fraction(1))));
+}
+
+// (a0 => b0) & (a1 => b1) & ... - at most three levels deep.
+static FormulaRef shallow_implications(unsigned pairs, Leaf leaf)
+{
+    std::vector<FormulaRef> operands;
+    for (unsigned i = 0; i < pairs; i++) {
+        operands.push_back(f_ptr<Implication>(leaf(2 * i), leaf(2 * i + 1)));
+    }
+    return f_ptr<Conjuction>(operands);
+}
+
+// a0 => b0 & (a1 => b1 & (a2 => ...)) - a level deeper with every atom.
+static FormulaRef deep_implications(unsigned pairs, Leaf leaf)
+{
+    auto formula = leaf(2 * pairs);
+    for (unsigned i = pairs; i-- > 0;) {
+        formula = f_ptr<Implication>(leaf(2 * i), f_ptr<Conjuction>(leaf(2 * i + 1), formula));
+    }
+    return formula;
+}
+
+static std::size_t count_nodes(FormulaRef formula)
+{
+    std::size_t count = 0;
+    std::vector<FormulaRef> stack{formula};
+    while (!stack.empty()) {
+        const auto current = stack.back();
+        stack.pop_back();
+        count++;
+        for_each_subformula(*current, [&stack](FormulaRef subformula) {
+            stack.push_back(subformula);
+        });
+    }
+    return count;
+}
+
+// Runs the pass on a freshly built formula in its own arena, so no memoized results are reused,
+// and reports the time it took per node of the input formula.
+static void run(const std::string &pass_name, const std::function<void(FormulaRef)> &pass, const std::string &shape, FormulaRef (*build)(unsigned, Leaf), Leaf leaf, unsigned pairs)
+{
+    FormulaArena arena;
+    ArenaScope arena_scope(arena);
+
+    const auto formula = build(pairs, leaf);
+    const auto nodes = count_nodes(formula);
+    const auto start = std::chrono::steady_clock::now();
+    pass(formula);
+    const auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << std::left << std::setw(24) << pass_name << std::setw(20) << shape
+              << std::right << std::setw(10) << nodes << std::setw(12) << std::fixed << std::setprecision(1) << elapsed / nodes << std::endl;
+}
+
+// A pass along with the atoms it is run over, and the number of their pairs.
+struct Benchmark
+{
+    std::string pass_name;
+    std::function<void(FormulaRef)> pass;
+    Leaf leaf;
+    unsigned pairs;
+};
+
+int main(int argc, char *argv[])
+{
+    const unsigned pairs = argc > 1 ? std::stoul(argv[1]) : 50000;
+    // The DNF of the negated deep formula has cubes for every level, each with an atom for every level
+    // above it, so the cube walk is run over far fewer pairs.
+    const unsigned cube_pairs = std::min(pairs, 100u);
+
+    const std::vector<Benchmark> benchmarks = {
+        {"simplify", [](FormulaRef formula) { simplify(formula); }, atom, pairs},
+        {"nnf", [](FormulaRef formula) { nnf(formula); }, atom, pairs},
+        {"pnf", [](FormulaRef formula) { pnf(formula); }, atom, pairs},
+        {"miniscope", [](FormulaRef formula) { miniscope(formula); }, atom, pairs},
+        {"substitute_equalities", [](FormulaRef formula) { substitute_equalities(formula); }, atom, pairs},
+        {"free_variables", [](FormulaRef formula) { free_variables(formula); }, atom, pairs},
+        {"to_string", [](FormulaRef formula) { formula_to_string(formula); }, atom, pairs},
+        {"cubes", [](FormulaRef formula) { formula_to_cubes(formula, true); }, atom, cube_pairs},
+        {"evaluate", [](FormulaRef formula) { evaluate(formula); }, ground_atom, pairs}
+    };
+
+    std::cout << std::left << std::setw(24) << "pass" << std::setw(20) << "shape"
+              << std::right << std::setw(10) << "nodes" << std::setw(12) << "ns/node" << std::endl;
+    for (const auto &benchmark : benchmarks) {
+        run(benchmark.pass_name, benchmark.pass, "shallow implications", shallow_implications, benchmark.leaf, benchmark.pairs);
+        run(benchmark.pass_name, benchmark.pass, "deep implications", deep_implications, benchmark.leaf, benchmark.pairs);
+    }
+
+    return 0;
+}
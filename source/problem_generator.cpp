@@ -0,0 +1,135 @@
+#include "problem_generator.hpp"
+
+#include <random>
+#include <stdexcept>
+
+static std::string var(unsigned index)
+{
+    return "x" + std::to_string(index);
+}
+
+static std::string quantifiers(char quantifier, unsigned first, unsigned last)
+{
+    std::string result;
+    for (unsigned i = first; i < last; i++) {
+        result += quantifier + var(i) + ".";
+    }
+    return result;
+}
+
+// !x0...!xn.x0 < x1 & ... & xn-1 < xn => x0 < xn
+static std::string transitivity(unsigned size)
+{
+    std::string chain;
+    for (unsigned i = 0; i < size; i++) {
+        chain += (i > 0 ? " & " : "") + var(i) + " < " + var(i + 1);
+    }
+    return quantifiers('!', 0, size + 1) + chain + " => " + var(0) + " < " + var(size);
+}
+
+// !x0...!xn-1.x0 < x1 & ... => ?y0...?yn-2.x0 < y0 & y0 < x1 & ...
+static std::string dense_group(unsigned size)
+{
+    std::string chain, between, witnesses;
+    for (unsigned i = 0; i + 1 < size; i++) {
+        const auto witness = "y" + std::to_string(i);
+        chain += (i > 0 ? " & " : "") + var(i) + " < " + var(i + 1);
+        between += (i > 0 ? " & " : "") + var(i) + " < " + witness + " & " + witness + " < " + var(i + 1);
+        witnesses += "?" + witness + ".";
+    }
+    return quantifiers('!', 0, size) + chain + " => " + witnesses + "(" + between + ")";
+}
+
+static std::string plus_constant(int constant)
+{
+    return (constant < 0 ? " - " : " + ") + std::to_string(constant < 0 ? -constant : constant);
+}
+
+// a*xi + c REL b*xj + d, with the free variables closed existentially by the prover.
+static std::string sparse_lra(unsigned size, unsigned seed)
+{
+    static const char *relations[] = {"<", ">", "<=", ">=", "!=", "="};
+
+    std::mt19937 random(seed);
+    std::uniform_int_distribution<unsigned> variable(0, size - 1), coefficient(1, 5);
+    std::uniform_int_distribution<int> constant(-20, 20);
+    // Equalities and disequalities are rarer than the inequalities.
+    std::discrete_distribution<unsigned> relation({4, 4, 2, 2, 1, 1});
+    std::string system;
+    for (unsigned i = 0; i < 2 * size; i++) {
+        const auto left = variable(random);
+        auto right = variable(random);
+        if (right == left) {
+            right = (right + 1) % size;
+        }
+        system += (i > 0 ? " & " : "") + std::to_string(coefficient(random)) + "*" + var(left) + plus_constant(constant(random))
+            + " " + relations[relation(random)] + " " + std::to_string(coefficient(random)) + "*" + var(right) + plus_constant(constant(random));
+    }
+    return system;
+}
+
+// ?x0...?xn-1.x0 != x1 & ... & x0 != 0 & ... - every disequality splits into two cubes.
+static std::string disequalities(unsigned size)
+{
+    std::string goal;
+    for (unsigned i = 0; i < size; i++) {
+        goal += (i > 0 ? " & " : "") + var(i) + " != " + std::to_string(i);
+        if (i + 1 < size) {
+            goal += " & " + var(i) + " != " + var(i + 1);
+        }
+    }
+    return quantifiers('?', 0, size) + goal;
+}
+
+// !x0.?x1.!x2...(x0 < x1 | x1 + x2 > 1) & (x1 < x2 | x2 + x3 > 2) & ...
+static std::string alternations(unsigned size)
+{
+    std::string prefix, body;
+    for (unsigned i = 0; i <= size; i++) {
+        prefix += (i % 2 == 0 ? "!" : "?") + var(i) + ".";
+    }
+    for (unsigned i = 0; i < size; i++) {
+        const auto next = i + 2 <= size ? var(i + 2) : var(0);
+        body += (i > 0 ? " & " : "") + std::string("(") + var(i) + " < " + var(i + 1) + " | " + var(i + 1) + " + " + next + " > " + std::to_string(i + 1) + ")";
+    }
+    return prefix + "(" + body + ")";
+}
+
+// ?x0.x0 = 0 & (x0 < 1 | x0 = 2 & (x0 < 3 | ...)) - a level deeper with every atom.
+static std::string nesting(unsigned size)
+{
+    std::string prefix, suffix;
+    for (unsigned i = 0; i < size; i++) {
+        prefix += var(0) + (i % 2 == 0 ? " = " : " < ") + std::to_string(i) + (i % 2 == 0 ? " & (" : " | (");
+        suffix += ")";
+    }
+    return "?" + var(0) + "." + prefix + var(0) + " < " + std::to_string(size) + suffix;
+}
+
+const std::vector<std::string> &problem_families()
+{
+    static const std::vector<std::string> families = {"transitivity", "dense_group", "sparse_lra", "disequalities", "alternations", "nesting"};
+    return families;
+}
+
+std::string generate_problem(const std::string &family, unsigned size, unsigned seed)
+{
+    if (size < 2) {
+        throw std::invalid_argument("The size of a problem must be at least 2");
+    }
+
+    if (family == "transitivity") {
+        return transitivity(size);
+    } else if (family == "dense_group") {
+        return dense_group(size);
+    } else if (family == "sparse_lra") {
+        return sparse_lra(size, seed);
+    } else if (family == "disequalities") {
+        return disequalities(size);
+    } else if (family == "alternations") {
+        return alternations(size);
+    } else if (family == "nesting") {
+        return nesting(size);
+    }
+    throw std::invalid_argument("Unknown problem family \"" + family + "\"");
+}
@@ -0,0 +1,21 @@
+#ifndef PROBLEM_GENERATOR_HPP
+#define PROBLEM_GENERATOR_HPP
+
+#include <string>
+#include <vector>
+
+// Families of problems that scale with their size:
+// - transitivity: a chain of n strict inequalities implies the one between its ends,
+// - dense_group: between every two of n ordered variables lies another one,
+// - sparse_lra: a random system of 2n constraints over n variables, two variables per constraint,
+// - disequalities: n variables that differ from each other and from n constants can all exist,
+// - alternations: n alternating quantifiers over a chain of constraints linking their variables,
+// - nesting: n levels of alternating conjuctions and disjunctions, nested one in another.
+const std::vector<std::string> &problem_families();
+
+// Generates the problem of the given family and size. Only the random families depend on the seed,
+// and the same seed always generates the same problem. Throws std::invalid_argument if there is
+// no such family.
+std::string generate_problem(const std::string &family, unsigned size, unsigned seed);
+
+#endif // PROBLEM_GENERATOR_HPP
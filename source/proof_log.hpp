@@ -0,0 +1,58 @@
+#ifndef PROOF_LOG_HPP
+#define PROOF_LOG_HPP
+
+#include <ostream>
+
+// How much of a proof gets logged - every level includes all the levels below it.
+enum class LogLevel
+{
+    OFF,
+    // The input formula, the quantifier free form it reduces to and the result.
+    SUMMARY,
+    // Which variables are eliminated, in what order and at what cost.
+    VARIABLES,
+    // Every intermediate formula of the elimination.
+    TRACE
+};
+
+// Writes the messages at or below its level into the buffer of the given stream. A message is written
+// by a callable taking the stream, which is only called if the message is logged at all - so nothing
+// a disabled message would show, like an intermediate formula, is ever computed or traversed.
+class ProofLog
+{
+public:
+    ProofLog()
+        : m_out(nullptr)
+        , m_level(LogLevel::OFF)
+    {
+
+    }
+
+    ProofLog(std::ostream &out, LogLevel level)
+        : m_out(level != LogLevel::OFF ? out.rdbuf() : nullptr)
+        , m_level(level)
+    {
+
+    }
+
+    bool enabled(LogLevel level) const
+    {
+        return level <= m_level && m_level != LogLevel::OFF;
+    }
+
+    // Logs the message written by the writer as a line of its own.
+    template <typename Writer>
+    void operator()(LogLevel level, Writer &&writer) const
+    {
+        if (enabled(level)) {
+            writer(m_out);
+            m_out << std::endl;
+        }
+    }
+
+private:
+    mutable std::ostream m_out;
+    LogLevel m_level;
+};
+
+#endif // PROOF_LOG_HPP
@@ -0,0 +1,40 @@
+#include "proof_stats.hpp"
+
+// Variable names are identifiers, so they never need to be escaped.
+static void write_variable_stats(std::ostream &out, const VariableEliminationStats &stats)
+{
+    out << "{\"variable\":\"" << stats.variable << "\""
+        << ",\"cubes\":" << stats.cubes
+        << ",\"eliminated_by_equality\":" << stats.eliminated_by_equality
+        << ",\"lt_bounds\":" << stats.lt_bounds
+        << ",\"gt_bounds\":" << stats.gt_bounds
+        << ",\"constraints_before\":" << stats.constraints_before
+        << ",\"rows_generated\":" << stats.rows_generated
+        << ",\"rows_pruned\":" << stats.rows_pruned
+        << ",\"constraints_after\":" << stats.constraints_after
+        << ",\"max_coefficient_bits\":" << stats.max_coefficient_bits
+        << "}";
+}
+
+void write_json(std::ostream &out, const ProofStats &stats)
+{
+    out << "{\"eliminations\":[";
+    for (std::size_t i = 0; i < stats.eliminations.size(); i++) {
+        if (i > 0) {
+            out << ",";
+        }
+        write_variable_stats(out, stats.eliminations[i]);
+    }
+    out << "],\"times_ns\":{"
+        << "\"parse\":" << stats.times.parse.count()
+        << ",\"normalization\":" << stats.times.normalization.count()
+        << ",\"normal_form\":" << stats.times.normal_form.count()
+        << ",\"elimination\":" << stats.times.elimination.count()
+        << ",\"evaluation\":" << stats.times.evaluation.count()
+        << "},\"peak_live_rows\":" << stats.peak_live_rows
+        << ",\"memory\":{";
+    for (std::size_t i = 0; i < stats.memory.live.size(); i++) {
+        out << "\"" << subsystem_name(static_cast<MemorySubsystem>(i)) << "\":{\"live\":" << stats.memory.live[i] << ",\"peak\":" << stats.memory.peak[i] << "},";
+    }
+    out << "\"total_peak\":" << stats.memory.total_peak << "},\"cache_hit\":" << (stats.cache_hit ? "true" : "false") << "}";
+}
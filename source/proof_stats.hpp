@@ -0,0 +1,59 @@
+#ifndef PROOF_STATS_HPP
+#define PROOF_STATS_HPP
+
+#include "memory_account.hpp"
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstddef>
+#include <ostream>
+
+// What eliminating a single variable from the cubes of a formula took.
+struct VariableEliminationStats
+{
+    std::string variable;
+    // Cubes of the DNF the variable was eliminated from.
+    std::size_t cubes = 0;
+    // Cubes in which the variable was eliminated by substituting an equality.
+    std::size_t eliminated_by_equality = 0;
+    std::size_t lt_bounds = 0;
+    std::size_t gt_bounds = 0;
+    std::size_t constraints_before = 0;
+    // Rows combined from pairs of bounds, and rows removed again by normalizing (and pruning) the cubes.
+    std::size_t rows_generated = 0;
+    std::size_t rows_pruned = 0;
+    std::size_t constraints_after = 0;
+    // Largest bit-length of a numerator or denominator of the rows, before they were normalized.
+    unsigned max_coefficient_bits = 0;
+};
+
+// Time spent in each phase of a proof.
+struct PhaseTimes
+{
+    std::chrono::nanoseconds parse{};
+    // Closing, miniscoping and substituting equalities.
+    std::chrono::nanoseconds normalization{};
+    // Building the DNF (or CNF) of the formulas the variables are eliminated from.
+    std::chrono::nanoseconds normal_form{};
+    std::chrono::nanoseconds elimination{};
+    std::chrono::nanoseconds evaluation{};
+};
+
+struct ProofStats
+{
+    // In the order the variables were eliminated in.
+    std::vector<VariableEliminationStats> eliminations;
+    PhaseTimes times;
+    // Most constraint rows held at once, over all the cubes of a formula.
+    std::size_t peak_live_rows = 0;
+    // Bytes held by each subsystem at the end of the proof, and at most during it.
+    MemoryUsage memory;
+    // The result was found in the result cache, so nothing was eliminated.
+    bool cache_hit = false;
+};
+
+// Writes the statistics as a single JSON object, with the times in nanoseconds.
+void write_json(std::ostream &out, const ProofStats &stats);
+
+#endif // PROOF_STATS_HPP
@@ -0,0 +1,427 @@
+#include "quantifier_free.hpp"
+#include "trace.hpp"
+#include "deadline.hpp"
+
+#include <cassert>
+#include <algorithm>
+#include <span>
+#include <iterator>
+#include <unordered_map>
+
+// Rewrites the atom (or its negation) into a disjunction of cubes with =, < and > relations only.
+static Cubes atom_to_cubes(AtomRef atom, bool negated)
+{
+    return std::visit(
+        overloaded{
+            [&atom, negated](const EqualTo &node) {
+                if (negated) {
+                    return Cubes{{a_ptr<LessThan>(node.term)}, {a_ptr<GreaterThan>(node.term)}};
+                }
+                return Cubes{{atom}};
+            },
+            [&atom, negated](const LessThan &node) {
+                if (negated) {
+                    return Cubes{{a_ptr<GreaterThan>(node.term)}, {a_ptr<EqualTo>(node.term)}};
+                }
+                return Cubes{{atom}};
+            },
+            [negated](const LessOrEqualTo &node) {
+                if (negated) {
+                    return Cubes{{a_ptr<GreaterThan>(node.term)}};
+                }
+                return Cubes{{a_ptr<LessThan>(node.term)}, {a_ptr<EqualTo>(node.term)}};
+            },
+            [&atom, negated](const GreaterThan &node) {
+                if (negated) {
+                    return Cubes{{a_ptr<LessThan>(node.term)}, {a_ptr<EqualTo>(node.term)}};
+                }
+                return Cubes{{atom}};
+            },
+            [negated](const GreaterOrEqualTo &node) {
+                if (negated) {
+                    return Cubes{{a_ptr<LessThan>(node.term)}};
+                }
+                return Cubes{{a_ptr<GreaterThan>(node.term)}, {a_ptr<EqualTo>(node.term)}};
+            },
+            [negated](const NotEqualTo &node) {
+                if (negated) {
+                    return Cubes{{a_ptr<EqualTo>(node.term)}};
+                }
+                return Cubes{{a_ptr<LessThan>(node.term)}, {a_ptr<GreaterThan>(node.term)}};
+            }
+        }, *atom
+    );
+}
+
+// Cubes of the subformulas already walked, by formula and polarity.
+using CubesCache = std::unordered_map<std::uint64_t, Cubes>;
+
+// Appends the cubes of a disjunct.
+static void add_cubes(Cubes &cubes, Cubes operand_cubes)
+{
+    if (cubes.empty()) {
+        cubes = std::move(operand_cubes);
+    } else {
+        cubes.insert(cubes.end(), std::make_move_iterator(operand_cubes.begin()), std::make_move_iterator(operand_cubes.end()));
+    }
+}
+
+// Conjoins the cubes with the cubes of a conjunct, a cube for every pair of them.
+static void multiply_cubes(Cubes &cubes, const Cubes &operand_cubes)
+{
+    Cubes product;
+    product.reserve(cubes.size() * operand_cubes.size());
+    for (const auto &cube : cubes) {
+        for (const auto &operand_cube : operand_cubes) {
+            auto &combined = product.emplace_back(cube);
+            for (const auto &atom : operand_cube) {
+                // Atoms are canonical and hash-consed, so a repeated constraint is always the same atom.
+                if (std::find(combined.cbegin(), combined.cend(), atom) == combined.cend()) {
+                    combined.push_back(atom);
+                }
+            }
+            check_deadline();
+        }
+    }
+    cubes = std::move(product);
+}
+
+// Identifies a subformula under a polarity, negated or not.
+static std::uint64_t polarity_key(FormulaRef formula, bool negated)
+{
+    return std::uint64_t{formula.index()} << 1 | negated;
+}
+
+// The subformulas (and polarities) a walk that pushes negations down to the atoms needs the results
+// of, for a quantifier free subformula under a polarity.
+static void polarity_dependencies(std::uint64_t key, std::vector<std::uint64_t> &dependencies)
+{
+    const auto formula = FormulaRef(key >> 1);
+    const bool negated = key & 1;
+    std::visit(
+        overloaded{
+            [&dependencies, negated](const Negation &node) {
+                dependencies.push_back(polarity_key(node.operand, !negated));
+            },
+            [&dependencies, negated](const Implication &node) {
+                dependencies.push_back(polarity_key(node.left, !negated));
+                dependencies.push_back(polarity_key(node.right, negated));
+            },
+            [&dependencies](const Equivalence &node) {
+                for (const auto operand : {node.left, node.right}) {
+                    dependencies.push_back(polarity_key(operand, false));
+                    dependencies.push_back(polarity_key(operand, true));
+                }
+            },
+            [&formula, &dependencies, negated](const auto &node) {
+                for_each_subformula(*formula, [&dependencies, negated](FormulaRef subformula) {
+                    dependencies.push_back(polarity_key(subformula, negated));
+                });
+            }
+        }, *formula
+    );
+}
+
+// Negations are pushed down to the atoms, the atoms are rewritten to =, < and > relations, and
+// conjuctions are distributed over the cubes of their operands as they come up, so no intermediate
+// formula is ever built. Shared subformulas are walked once per polarity, bottom-up with an explicit
+// work stack.
+Cubes formula_to_cubes(FormulaRef formula, bool negated)
+{
+    // The cubes of a subformula are released once the cubes of the last subformula built from them are,
+    // so a deep formula never keeps the cubes of all of its levels around.
+    const auto root = polarity_key(formula, negated);
+    std::unordered_map<std::uint64_t, std::size_t> consumers{{root, 1}};
+    std::vector<std::uint64_t> walk{root};
+    std::vector<std::uint64_t> dependencies;
+    while (!walk.empty()) {
+        const auto key = walk.back();
+        walk.pop_back();
+        dependencies.clear();
+        polarity_dependencies(key, dependencies);
+        for (const auto &dependency : dependencies) {
+            if (consumers[dependency]++ == 0) {
+                walk.push_back(dependency);
+            }
+        }
+    }
+
+    CubesCache cache;
+    const auto compute = [&cache, &consumers](std::uint64_t key) {
+        const auto current = FormulaRef(key >> 1);
+        const bool negated = key & 1;
+        const auto cubes_of = [&cache](FormulaRef formula, bool negated) -> const Cubes & {
+            return cache.at(polarity_key(formula, negated));
+        };
+        // The cubes of a subformula nothing else is built from are moved rather than copied.
+        const auto take_cubes = [&cache, &consumers](FormulaRef formula, bool negated) {
+            const auto key = polarity_key(formula, negated);
+            auto &cubes = cache.at(key);
+            return consumers.at(key) == 1 ? Cubes(std::move(cubes)) : Cubes(cubes);
+        };
+
+        // Under a negation, a conjuction turns into a disjunction of the negated operands, and vice versa.
+        const auto nary_to_cubes = [&cubes_of, &take_cubes](std::span<const FormulaRef> operands, bool negated, bool is_conjuction) {
+            Cubes cubes;
+            if (!is_conjuction) {
+                for (const auto &operand : operands) {
+                    add_cubes(cubes, take_cubes(operand, negated));
+                }
+                return cubes;
+            }
+
+            if (operands.empty()) {
+                return Cubes{Cube{}};
+            }
+            cubes = take_cubes(operands.front(), negated);
+            for (std::size_t i = 1; i < operands.size() && !cubes.empty(); i++) {
+                multiply_cubes(cubes, cubes_of(operands[i], negated));
+            }
+            return cubes;
+        };
+
+        return std::visit(
+            overloaded{
+                [negated](const AtomWrapper &node) {
+                    return atom_to_cubes(node.atom, negated);
+                },
+                [negated](const True &node) {
+                    return negated ? Cubes{} : Cubes{Cube{}};
+                },
+                [negated](const False &node) {
+                    return negated ? Cubes{Cube{}} : Cubes{};
+                },
+                [negated, &take_cubes](const Negation &node) {
+                    return take_cubes(node.operand, !negated);
+                },
+                [negated, &nary_to_cubes](const Conjuction &node) {
+                    return nary_to_cubes(node.operands, negated, !negated);
+                },
+                [negated, &nary_to_cubes](const Disjunction &node) {
+                    return nary_to_cubes(node.operands, negated, negated);
+                },
+                [negated, &cubes_of, &take_cubes](const Implication &node) {
+                    // l => r is ~l | r, and its negation l & ~r.
+                    auto cubes = take_cubes(node.left, !negated);
+                    if (negated) {
+                        multiply_cubes(cubes, cubes_of(node.right, true));
+                    } else {
+                        add_cubes(cubes, take_cubes(node.right, false));
+                    }
+                    return cubes;
+                },
+                [negated, &cubes_of](const Equivalence &node) {
+                    // l <=> r is (~l | r) & (~r | l), and its negation (l & ~r) | (r & ~l).
+                    const auto &left = cubes_of(node.left, false);
+                    const auto &not_left = cubes_of(node.left, true);
+                    const auto &right = cubes_of(node.right, false);
+                    const auto &not_right = cubes_of(node.right, true);
+                    if (negated) {
+                        auto cubes = left;
+                        multiply_cubes(cubes, not_right);
+                        auto other = right;
+                        multiply_cubes(other, not_left);
+                        add_cubes(cubes, other);
+                        return cubes;
+                    }
+                    auto cubes = not_left;
+                    add_cubes(cubes, right);
+                    auto other = not_right;
+                    add_cubes(other, left);
+                    multiply_cubes(cubes, other);
+                    return cubes;
+                },
+                [](const auto &node) {
+                    assert(!"Unreachable");
+                    return Cubes();
+                }
+            }, *current
+        );
+    };
+
+    const auto compute_and_release = [&cache, &consumers, &dependencies, &compute](std::uint64_t key) {
+        auto cubes = compute(key);
+        dependencies.clear();
+        polarity_dependencies(key, dependencies);
+        for (const auto &dependency : dependencies) {
+            if (--consumers.at(dependency) == 0) {
+                cache.erase(dependency);
+            }
+        }
+        return cubes;
+    };
+
+    memoize_in(cache, root, polarity_dependencies, compute_and_release);
+    return std::move(cache.at(root));
+}
+
+// Negations are pushed down to the atoms as the formula is walked, bottom-up with an explicit work
+// stack, and shared subformulas are estimated once per polarity.
+NormalFormSize estimate_normal_form_size(FormulaRef formula, bool disjunctive, bool negated)
+{
+    static constexpr auto sum = [](const NormalFormSize &l, const NormalFormSize &r) {
+        return NormalFormSize{l.members + r.members, l.literals + r.literals};
+    };
+    static constexpr auto product = [](const NormalFormSize &l, const NormalFormSize &r) {
+        return NormalFormSize{l.members * r.members, l.literals * r.members + r.literals * l.members};
+    };
+
+    std::unordered_map<std::uint64_t, NormalFormSize> sizes;
+    const auto size_of = [&sizes](FormulaRef formula, bool negated) {
+        return sizes.at(polarity_key(formula, negated));
+    };
+
+    const auto compute = [disjunctive, &size_of](std::uint64_t key) {
+        const auto current = FormulaRef(key >> 1);
+        const bool negated = key & 1;
+        const auto fold = [negated, &size_of](std::span<const FormulaRef> operands, bool is_product) {
+            auto size = size_of(operands[0], negated);
+            for (std::size_t i = 1; i < operands.size(); i++) {
+                const auto operand_size = size_of(operands[i], negated);
+                size = is_product ? product(size, operand_size) : sum(size, operand_size);
+            }
+            return size;
+        };
+        // l => r is ~l | r, and l <=> r is (l => r) & (r => l).
+        const auto implication = [disjunctive, &size_of](FormulaRef left, FormulaRef right, bool negated) {
+            const auto is_product = disjunctive == negated;
+            const auto left_size = size_of(left, !negated);
+            const auto right_size = size_of(right, negated);
+            return is_product ? product(left_size, right_size) : sum(left_size, right_size);
+        };
+
+        return std::visit(
+            overloaded{
+                [disjunctive, negated, &fold](const Conjuction &node) {
+                    return fold(node.operands, disjunctive != negated);
+                },
+                [disjunctive, negated, &fold](const Disjunction &node) {
+                    return fold(node.operands, disjunctive == negated);
+                },
+                [negated, &size_of](const Negation &node) {
+                    return size_of(node.operand, !negated);
+                },
+                [negated, &implication](const Implication &node) {
+                    return implication(node.left, node.right, negated);
+                },
+                [disjunctive, negated, &implication](const Equivalence &node) {
+                    const auto left_size = implication(node.left, node.right, negated);
+                    const auto right_size = implication(node.right, node.left, negated);
+                    return disjunctive != negated ? product(left_size, right_size) : sum(left_size, right_size);
+                },
+                [](const True &node) {
+                    return NormalFormSize{1, 0};
+                },
+                [](const False &node) {
+                    return NormalFormSize{1, 0};
+                },
+                [](const auto &node) {
+                    return NormalFormSize{1, 1};
+                }
+            }, *current
+        );
+    };
+
+    return memoize_in(sizes, polarity_key(formula, negated), polarity_dependencies, compute);
+}
+
+// A quantifier free formula has no variables left, so the terms of its atoms are just their constants.
+static bool evaluate(const AtomRef atom)
+{
+    static constexpr auto value_of = [](TermRef term) {
+        assert(term->coefs.empty());
+        return term->constant;
+    };
+
+    return std::visit(
+        overloaded{
+            [](const EqualTo &node) {
+                return value_of(node.term) == Fraction{};
+            },
+            [](const LessThan &node) {
+                return value_of(node.term) < Fraction{};
+            },
+            [](const LessOrEqualTo &node) {
+                return value_of(node.term) <= Fraction{};
+            },
+            [](const GreaterThan &node) {
+                return value_of(node.term) > Fraction{};
+            },
+            [](const GreaterOrEqualTo &node) {
+                return value_of(node.term) >= Fraction{};
+            },
+            [](const NotEqualTo &node) {
+                return value_of(node.term) != Fraction{};
+            }
+        }, *atom
+    );
+}
+
+// The evaluation is a post-order traversal with an explicit stack. A node is visited twice - first to
+// schedule its operands, and then to combine their values, which are by then on top of the value stack.
+bool evaluate(FormulaRef formula)
+{
+    TraceSpan span("evaluate");
+    std::vector<std::pair<FormulaRef, bool>> stack{{formula, false}};
+    std::vector<bool> values;
+    const auto pop_value = [&values]() {
+        const bool value = values.back();
+        values.pop_back();
+        return value;
+    };
+    while (!stack.empty()) {
+        const auto [current, operands_evaluated] = stack.back();
+        stack.pop_back();
+        if (!operands_evaluated) {
+            stack.push_back({current, true});
+            for_each_subformula(*current, [&stack](FormulaRef subformula) {
+                stack.push_back({subformula, false});
+            });
+            continue;
+        }
+        // The operands were scheduled in order, so the value of the last one is on top.
+        values.push_back(std::visit(
+            overloaded{
+                [](const AtomWrapper &node) {
+                    return evaluate(node.atom);
+                },
+                [](const True &node) {
+                    return true;
+                },
+                [](const False &node) {
+                    return false;
+                },
+                [&pop_value](const Negation &node) {
+                    return !pop_value();
+                },
+                [&pop_value](const Conjuction &node) {
+                    bool value = true;
+                    for (std::size_t i = 0; i < node.operands.size(); i++) {
+                        value = pop_value() && value;
+                    }
+                    return value;
+                },
+                [&pop_value](const Disjunction &node) {
+                    bool value = false;
+                    for (std::size_t i = 0; i < node.operands.size(); i++) {
+                        value = pop_value() || value;
+                    }
+                    return value;
+                },
+                [&pop_value](const Implication &node) {
+                    const bool right = pop_value();
+                    return !pop_value() || right;
+                },
+                [&pop_value](const Equivalence &node) {
+                    const bool right = pop_value();
+                    return pop_value() == right;
+                },
+                [](const auto &node) {
+                    assert(!"Unreachable");
+                    return false;
+                }
+            }, *current
+        ));
+    }
+    return values.back();
+}
@@ -0,0 +1,30 @@
+#ifndef QUANTIFIER_FREE_HPP
+#define QUANTIFIER_FREE_HPP
+
+#include "fol_ast.hpp"
+#include "memory_account.hpp"
+
+#include <vector>
+
+// A conjuction of atoms, each relating its terms by =, < or >. A DNF can have exponentially many
+// cubes, so their storage is accounted for.
+using Cube = std::vector<AtomRef, CountingAllocator<AtomRef, MemorySubsystem::CUBES>>;
+using Cubes = std::vector<Cube, CountingAllocator<Cube, MemorySubsystem::CUBES>>;
+
+// Brings a quantifier free formula (or its negation) into DNF, as the cubes it is a disjunction of.
+Cubes formula_to_cubes(FormulaRef formula, bool negated);
+
+struct NormalFormSize
+{
+    double members;
+    double literals;
+};
+
+// Estimates the size of the disjunctive (or dually, conjunctive) normal form of a quantifier free formula,
+// or of its negation.
+NormalFormSize estimate_normal_form_size(FormulaRef formula, bool disjunctive, bool negated);
+
+// Evaluates a quantifier free formula without variables.
+bool evaluate(FormulaRef formula);
+
+#endif // QUANTIFIER_FREE_HPP
@@ -0,0 +1,345 @@
+#include "result_cache.hpp"
+
+#include <vector>
+#include <array>
+#include <bit>
+#include <atomic>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+template <typename Relation>
+static constexpr char relation_symbol()
+{
+    if constexpr (std::is_same_v<Relation, EqualTo>) {
+        return '=';
+    } else if constexpr (std::is_same_v<Relation, LessThan>) {
+        return '<';
+    } else if constexpr (std::is_same_v<Relation, LessOrEqualTo>) {
+        return 'l';
+    } else if constexpr (std::is_same_v<Relation, GreaterThan>) {
+        return '>';
+    } else if constexpr (std::is_same_v<Relation, GreaterOrEqualTo>) {
+        return 'g';
+    } else {
+        return '!';
+    }
+}
+
+static void append_fraction(std::string &out, const Fraction &fraction)
+{
+    out += std::to_string(fraction.get_numerator());
+    out += '/';
+    out += std::to_string(fraction.get_denominator());
+}
+
+// Bound variables are named by the depth of the quantifier binding them, counted from the outside.
+static std::size_t canonical_name(const std::vector<SymbolId> &bound, SymbolId symbol)
+{
+    const auto it = std::find(bound.crbegin(), bound.crend(), symbol);
+    return it != bound.crend() ? bound.crend() - it - 1 : SIZE_MAX;
+}
+
+// The renamed variables are ordered differently than the symbols, so the term is sorted and scaled
+// again, to a leading coefficient of 1 - mirroring the relation when the scaling factor is negative.
+template <typename Relation>
+static void append_atom(std::string &out, const LinearTerm &term, const std::vector<SymbolId> &bound)
+{
+    std::vector<std::pair<std::size_t, Fraction>> coefs;
+    coefs.reserve(term.coefs.size());
+    for (const auto &[symbol, coef] : term.coefs) {
+        coefs.emplace_back(canonical_name(bound, symbol), coef);
+    }
+    std::sort(coefs.begin(), coefs.end(), [](const auto &left, const auto &right) { return left.first < right.first; });
+
+    const auto leading = coefs.empty() ? term.constant : coefs.front().second;
+    const auto factor = leading != Fraction{} ? Fraction(1) / leading : Fraction(1);
+    if (leading < Fraction{}) {
+        out += relation_symbol<typename Mirrored<Relation>::type>();
+    } else {
+        out += relation_symbol<Relation>();
+    }
+    for (const auto &[name, coef] : coefs) {
+        out += std::to_string(name);
+        out += ':';
+        append_fraction(out, coef * factor);
+        out += ',';
+    }
+    append_fraction(out, term.constant * factor);
+}
+
+// Replaces the canonical forms of the operands of a commutative connective, the last ones on the
+// stack, with the form of the connective - in which they are sorted.
+static void join_canonical_operands(char connective, std::size_t count, std::vector<std::string> &forms)
+{
+    const auto first = forms.end() - static_cast<std::ptrdiff_t>(count);
+    std::sort(first, forms.end());
+    std::string out(1, connective);
+    out += '(';
+    for (auto it = first; it != forms.end(); it++) {
+        out += *it;
+        out += ';';
+    }
+    out += ')';
+    forms.erase(first, forms.end());
+    forms.push_back(std::move(out));
+}
+
+// Walks the formula with an explicit work stack, so its depth is never limited by the call stack. A formula
+// is expanded into its subformulas first, and its form is built once theirs are on the stack of forms.
+static std::string canonical_form(FormulaRef formula)
+{
+    std::vector<SymbolId> bound;
+    std::vector<std::pair<FormulaRef, bool>> stack{{formula, false}};
+    std::vector<std::string> forms;
+    std::vector<FormulaRef> subformulas;
+    while (!stack.empty()) {
+        const auto [current, is_expanded] = stack.back();
+        if (!is_expanded) {
+            stack.back().second = true;
+            std::visit(
+                overloaded{
+                    [&bound, &stack, &forms](const AtomWrapper &node) {
+                        std::string out;
+                        std::visit(
+                            [&out, &bound](const auto &atom) {
+                                append_atom<std::decay_t<decltype(atom)>>(out, *atom.term, bound);
+                            }, *node.atom
+                        );
+                        forms.push_back(std::move(out));
+                        stack.pop_back();
+                    },
+                    [&stack, &forms](const True &node) {
+                        forms.push_back("T");
+                        stack.pop_back();
+                    },
+                    [&stack, &forms](const False &node) {
+                        forms.push_back("F");
+                        stack.pop_back();
+                    },
+                    [&bound, &stack](const UniversalQuantification &node) {
+                        bound.push_back(node.var_symbol);
+                        stack.push_back({node.formula, false});
+                    },
+                    [&bound, &stack](const ExistentialQuantification &node) {
+                        bound.push_back(node.var_symbol);
+                        stack.push_back({node.formula, false});
+                    },
+                    [&current, &stack, &subformulas](const auto &node) {
+                        subformulas.clear();
+                        for_each_subformula(*current, [&subformulas](FormulaRef subformula) {
+                            subformulas.push_back(subformula);
+                        });
+                        for (auto it = subformulas.rbegin(); it != subformulas.rend(); it++) {
+                            stack.push_back({*it, false});
+                        }
+                    }
+                }, *current
+            );
+            continue;
+        }
+
+        stack.pop_back();
+        std::visit(
+            overloaded{
+                [&forms](const Negation &node) {
+                    forms.back() = "~(" + forms.back() + ")";
+                },
+                [&forms](const Conjuction &node) {
+                    join_canonical_operands('&', node.operands.size(), forms);
+                },
+                [&forms](const Disjunction &node) {
+                    join_canonical_operands('|', node.operands.size(), forms);
+                },
+                [&forms](const Implication &node) {
+                    auto right = std::move(forms.back());
+                    forms.pop_back();
+                    forms.back() = ">(" + forms.back() + ";" + right + ")";
+                },
+                [&forms](const Equivalence &node) {
+                    join_canonical_operands('=', 2, forms);
+                },
+                [&bound, &forms](const UniversalQuantification &node) {
+                    bound.pop_back();
+                    forms.back() = "A(" + forms.back() + ")";
+                },
+                [&bound, &forms](const ExistentialQuantification &node) {
+                    bound.pop_back();
+                    forms.back() = "E(" + forms.back() + ")";
+                },
+                [](const auto &node) {
+
+                }
+            }, *current
+        );
+    }
+    return std::move(forms.back());
+}
+
+CacheKey cache_key(FormulaRef formula)
+{
+    const auto form = canonical_form(formula);
+    // Two unrelated hashes, FNV-1a and a multiply-xorshift one, so that a collision of both is unlikely.
+    CacheKey key{0xcbf29ce484222325, 0x9e3779b97f4a7c15};
+    for (const auto c : form) {
+        key.high = (key.high ^ static_cast<unsigned char>(c)) * 0x100000001b3;
+        key.low = (key.low ^ static_cast<unsigned char>(c)) * 0xff51afd7ed558ccd;
+        key.low ^= key.low >> 29;
+    }
+    return key;
+}
+
+struct ResultCache::Header
+{
+    char magic[8];
+    std::uint64_t bucket_count;
+    // Incremented on every access, to stamp the entries with the time they were last used.
+    std::uint64_t clock;
+};
+
+struct ResultCache::Entry
+{
+    std::uint64_t key_high;
+    std::uint64_t key_low;
+    std::uint64_t last_used;
+    // 0 for an empty entry, 1 for a formula that is not a theorem and 2 for a theorem.
+    std::uint64_t result;
+};
+
+static constexpr char cache_magic[8] = {'F', 'M', 'C', 'A', 'C', 'H', 'E', '1'};
+static constexpr std::size_t bucket_size = 8;
+static constexpr std::size_t header_size = 64;
+
+// Holds a lock on the whole file for its lifetime - shared readers can still update the access
+// times of the entries, which they do atomically.
+class FileLock
+{
+public:
+    FileLock(int fd, int operation) : m_fd(fd)
+    {
+        while (::flock(fd, operation) < 0) {
+            if (errno != EINTR) {
+                throw std::system_error(errno, std::generic_category(), "Could not lock the result cache");
+            }
+        }
+    }
+    ~FileLock() { ::flock(m_fd, LOCK_UN); }
+
+    FileLock(const FileLock &) = delete;
+    FileLock &operator=(const FileLock &) = delete;
+
+private:
+    int m_fd;
+};
+
+ResultCache::ResultCache(const std::string &path, std::size_t max_bytes)
+    : m_fd(::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644))
+    , m_data(MAP_FAILED)
+{
+    if (m_fd < 0) {
+        throw std::system_error(errno, std::generic_category(), "Could not open the result cache \"" + path + "\"");
+    }
+    try {
+        // Creating the cache is exclusive, so no process ever sees a partially initialized one.
+        FileLock lock(m_fd, LOCK_EX);
+        struct stat status;
+        if (::fstat(m_fd, &status) < 0) {
+            throw std::system_error(errno, std::generic_category(), "Could not open the result cache \"" + path + "\"");
+        }
+        // The bucket count is checked against the size of the file before it is multiplied, so a corrupt
+        // header can't make the product overflow into a match.
+        Header existing{};
+        const auto file_size = static_cast<std::size_t>(std::max<off_t>(status.st_size, 0));
+        const auto is_valid = file_size >= header_size
+            && ::pread(m_fd, &existing, sizeof(existing), 0) == sizeof(existing)
+            && std::memcmp(existing.magic, cache_magic, sizeof(cache_magic)) == 0
+            && std::has_single_bit(existing.bucket_count)
+            && existing.bucket_count <= (file_size - header_size) / (bucket_size * sizeof(Entry))
+            && file_size == header_size + existing.bucket_count * bucket_size * sizeof(Entry);
+        if (is_valid) {
+            m_size = file_size;
+            m_bucket_count = existing.bucket_count;
+        } else {
+            // Rounds the bucket count down to a power of 2, so a key picks its bucket by a mask.
+            const auto buckets = std::bit_floor(std::max<std::size_t>(1, (max_bytes > header_size ? max_bytes - header_size : 0) / (bucket_size * sizeof(Entry))));
+            m_size = header_size + buckets * bucket_size * sizeof(Entry);
+            // Truncating to 0 first zeroes all the entries of an invalid file.
+            Header header{};
+            std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+            header.bucket_count = buckets;
+            m_bucket_count = buckets;
+            if (::ftruncate(m_fd, 0) < 0 || ::ftruncate(m_fd, m_size) < 0 || ::pwrite(m_fd, &header, sizeof(header), 0) != sizeof(header)) {
+                throw std::system_error(errno, std::generic_category(), "Could not create the result cache \"" + path + "\"");
+            }
+        }
+        m_data = ::mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+        if (m_data == MAP_FAILED) {
+            throw std::system_error(errno, std::generic_category(), "Could not map the result cache \"" + path + "\"");
+        }
+    } catch (...) {
+        ::close(m_fd);
+        throw;
+    }
+}
+
+ResultCache::~ResultCache()
+{
+    ::munmap(m_data, m_size);
+    ::close(m_fd);
+}
+
+ResultCache::Header &ResultCache::header() const
+{
+    return *static_cast<Header*>(m_data);
+}
+
+ResultCache::Entry *ResultCache::bucket(const CacheKey &key) const
+{
+    auto *entries = reinterpret_cast<Entry*>(static_cast<char*>(m_data) + header_size);
+    return entries + (key.high & (m_bucket_count - 1)) * bucket_size;
+}
+
+std::optional<bool> ResultCache::lookup(const CacheKey &key)
+{
+    std::lock_guard guard(m_mutex);
+    FileLock lock(m_fd, LOCK_SH);
+    auto *entries = bucket(key);
+    for (std::size_t i = 0; i < bucket_size; i++) {
+        if (entries[i].result != 0 && entries[i].key_high == key.high && entries[i].key_low == key.low) {
+            const auto now = std::atomic_ref(header().clock).fetch_add(1, std::memory_order_relaxed);
+            std::atomic_ref(entries[i].last_used).store(now, std::memory_order_relaxed);
+            return entries[i].result == 2;
+        }
+    }
+    return std::nullopt;
+}
+
+void ResultCache::insert(const CacheKey &key, bool is_theorem)
+{
+    std::lock_guard guard(m_mutex);
+    FileLock lock(m_fd, LOCK_EX);
+    auto *entries = bucket(key);
+    // Replaces the entry of the same key, or else an empty one, or else the least recently used one.
+    auto *victim = entries;
+    for (std::size_t i = 0; i < bucket_size; i++) {
+        if (entries[i].result != 0 && entries[i].key_high == key.high && entries[i].key_low == key.low) {
+            victim = &entries[i];
+            break;
+        } else if (victim->result != 0 && (entries[i].result == 0 || entries[i].last_used < victim->last_used)) {
+            victim = &entries[i];
+        }
+    }
+    // The result goes last, so an insert cut short by a crash leaves an empty entry behind.
+    victim->result = 0;
+    victim->key_high = key.high;
+    victim->key_low = key.low;
+    victim->last_used = header().clock++;
+    victim->result = is_theorem ? 2 : 1;
+}
@@ -0,0 +1,62 @@
+#ifndef RESULT_CACHE_HPP
+#define RESULT_CACHE_HPP
+
+#include "fol_ast.hpp"
+
+#include <string>
+#include <mutex>
+#include <optional>
+#include <cstddef>
+#include <cstdint>
+
+// 128-bit hash of the canonical form of a closed formula.
+struct CacheKey
+{
+    std::uint64_t high;
+    std::uint64_t low;
+};
+
+// Returns the key of the closed formula, which is the same for all formulas that only differ in
+// the names of their bound variables, the order of the operands of their conjuctions, disjunctions
+// and equivalences, and the scaling of their atoms. Unlike symbol ids, keys are the same in every
+// process, so they can be stored.
+CacheKey cache_key(FormulaRef formula);
+
+// Results of proofs by the keys of their formulas, kept in a memory-mapped file. The file holds a
+// fixed number of entries, grouped into buckets by key, and evicts the least recently used entry of
+// a full bucket - so it never outgrows the size it was created with. It can be shared by any number
+// of processes, which lock it for every access, and by any number of threads of each of them.
+class ResultCache
+{
+public:
+    // Opens the cache file, creating it with as many entries as fit into max_bytes if it doesn't exist.
+    // An existing cache keeps the size it was created with. Throws std::system_error if the file can't
+    // be opened or mapped.
+    ResultCache(const std::string &path, std::size_t max_bytes);
+    ~ResultCache();
+
+    ResultCache(const ResultCache &) = delete;
+    ResultCache &operator=(const ResultCache &) = delete;
+
+    // Returns if the formula with the key is a theorem, if its result is cached.
+    std::optional<bool> lookup(const CacheKey &key);
+    void insert(const CacheKey &key, bool is_theorem);
+
+private:
+    struct Header;
+    struct Entry;
+
+    int m_fd;
+    void *m_data;
+    std::size_t m_size;
+    // Validated when the cache is opened, so the one in the shared header is never trusted afterwards.
+    std::size_t m_bucket_count;
+    // File locks are held by the file as a whole, not by the threads, so the threads of this process
+    // take turns through the mutex first.
+    std::mutex m_mutex;
+
+    Header &header() const;
+    Entry *bucket(const CacheKey &key) const;
+};
+
+#endif // RESULT_CACHE_HPP
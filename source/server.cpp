@@ -0,0 +1,354 @@
+#include "server.hpp"
+#include "batch.hpp"
+#include "theorem_prover.hpp"
+#include "symbol_table.hpp"
+
+#include <array>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stop_token>
+#include <deque>
+#include <set>
+#include <vector>
+#include <sstream>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <limits>
+#include <system_error>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <unistd.h>
+
+// Counts of the requests served, shared by all the connections.
+struct ServerStats
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::atomic<std::size_t> connections = 0;
+    std::atomic<std::size_t> active_connections = 0;
+    std::atomic<std::size_t> refused_connections = 0;
+    std::atomic<std::size_t> failed_accepts = 0;
+    std::atomic<std::size_t> timed_out_connections = 0;
+    std::atomic<std::size_t> requests = 0;
+    std::atomic<std::size_t> invalid_requests = 0;
+    std::array<std::atomic<std::size_t>, 5> outcomes{};
+    std::atomic<long long> proof_time_ns = 0;
+};
+
+static constexpr std::array<const char*, 5> outcome_names = {"theorem", "not_theorem", "timeout", "out_of_memory", "error"};
+
+// Lines longer than this are refused, so a client can't make the server buffer without bound.
+static constexpr std::size_t max_line_length = 1 << 20;
+
+// The pause before accepting again after running out of descriptors or memory.
+static constexpr int accept_retry_delay_ms = 100;
+
+static void write_stats(std::ostream &out, const ServerStats &stats)
+{
+    out << "{\"uptime_ms\":" << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - stats.start).count()
+        << ",\"connections\":" << stats.connections
+        << ",\"active_connections\":" << stats.active_connections
+        << ",\"refused_connections\":" << stats.refused_connections
+        << ",\"failed_accepts\":" << stats.failed_accepts
+        << ",\"timed_out_connections\":" << stats.timed_out_connections
+        << ",\"requests\":" << stats.requests
+        << ",\"invalid_requests\":" << stats.invalid_requests;
+    for (std::size_t i = 0; i < outcome_names.size(); i++) {
+        out << ",\"" << outcome_names[i] << "\":" << stats.outcomes[i];
+    }
+    out << ",\"proof_time_ns\":" << stats.proof_time_ns << ",\"symbols\":" << symbol_count() << "}";
+}
+
+// Answers a single request line.
+static std::string handle_request(const std::string &request, const ServerOptions &options, ServerStats &stats)
+{
+    stats.requests++;
+    std::istringstream in(request);
+    std::string command;
+    in >> command;
+
+    std::ostringstream response;
+    auto time_limit = options.time_limit;
+    if (command == "stats") {
+        write_stats(response, stats);
+        return std::move(response).str();
+    } else if (command == "prove_within") {
+        long long milliseconds;
+        if (!(in >> milliseconds) || milliseconds < 0) {
+            stats.invalid_requests++;
+            return "{\"result\":\"error\",\"error\":\"Expected a time limit in milliseconds\"}";
+        }
+        time_limit = std::chrono::milliseconds(milliseconds);
+    } else if (command != "prove") {
+        stats.invalid_requests++;
+        return "{\"result\":\"error\",\"error\":\"Unknown request - expected prove, prove_within or stats\"}";
+    }
+
+    std::string formula;
+    std::getline(in >> std::ws, formula);
+    const TheoremProver prover(true, options.memory_limit, time_limit, options.cache);
+    const auto start = std::chrono::steady_clock::now();
+    response << "{";
+    const auto outcome = write_proof_result(response, prover, formula, options.stats);
+    response << "}";
+    stats.outcomes[static_cast<std::size_t>(outcome)]++;
+    stats.proof_time_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    return std::move(response).str();
+}
+
+static bool send_all(int fd, const std::string &data)
+{
+    for (std::size_t sent = 0; sent < data.size();) {
+        const auto count = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        } else if (count <= 0) {
+            return false;
+        }
+        sent += count;
+    }
+    return true;
+}
+
+// Waits for the client to send more, returning false if it sends nothing within the idle timeout.
+static bool wait_readable(int fd, std::chrono::seconds idle_timeout)
+{
+    const auto timeout = idle_timeout.count() > 0 ? static_cast<int>(std::min<long long>(idle_timeout.count() * 1000, std::numeric_limits<int>::max())) : -1;
+    pollfd polled{fd, POLLIN, 0};
+    for (;;) {
+        const auto ready = ::poll(&polled, 1, timeout);
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        // An error is left for the recv to report.
+        return ready != 0;
+    }
+}
+
+// Answers the requests of a connection in order, until the client closes it, stays idle for too long or
+// the server stops.
+static void handle_connection(int fd, const ServerOptions &options, ServerStats &stats)
+{
+    stats.connections++;
+    stats.active_connections++;
+    std::string buffer;
+    std::array<char, 4096> chunk;
+    bool open = true;
+    while (open) {
+        if (!wait_readable(fd, options.idle_timeout)) {
+            stats.timed_out_connections++;
+            break;
+        }
+        const auto count = ::recv(fd, chunk.data(), chunk.size(), 0);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        } else if (count <= 0) {
+            break;
+        }
+        buffer.append(chunk.data(), count);
+
+        std::size_t begin = 0;
+        for (auto end = buffer.find('\n'); end != std::string::npos && open; end = buffer.find('\n', begin)) {
+            auto request = buffer.substr(begin, end - begin);
+            if (!request.empty() && request.back() == '\r') {
+                request.pop_back();
+            }
+            begin = end + 1;
+            if (!request.empty()) {
+                open = send_all(fd, handle_request(request, options, stats) + "\n");
+            }
+        }
+        buffer.erase(0, begin);
+        if (buffer.size() > max_line_length) {
+            stats.invalid_requests++;
+            send_all(fd, "{\"result\":\"error\",\"error\":\"Request too long\"}\n");
+            break;
+        }
+    }
+    stats.active_connections--;
+}
+
+// Hands the accepted connections over to a fixed number of connection threads, and keeps track of the
+// ones being handled, so that they can be stopped.
+class ConnectionQueue
+{
+public:
+    explicit ConnectionQueue(std::size_t threads) : m_idle_threads(threads) {}
+
+    // Queues the connection for an idle thread, returning false if there is none.
+    bool push(int fd)
+    {
+        std::scoped_lock lock(m_mutex);
+        if (m_stopped || m_idle_threads == 0) {
+            return false;
+        }
+        m_idle_threads--;
+        m_pending.push_back(fd);
+        m_ready.notify_one();
+        return true;
+    }
+
+    // Waits for a connection to handle, returning -1 once the server stops.
+    int next()
+    {
+        std::unique_lock lock(m_mutex);
+        m_ready.wait(lock, [this] { return m_stopped || !m_pending.empty(); });
+        if (m_stopped) {
+            return -1;
+        }
+        const auto fd = m_pending.front();
+        m_pending.pop_front();
+        m_active.insert(fd);
+        return fd;
+    }
+
+    // Closes a handled connection, making its thread idle again.
+    void done(int fd)
+    {
+        std::scoped_lock lock(m_mutex);
+        m_active.erase(fd);
+        ::close(fd);
+        m_idle_threads++;
+    }
+
+    // Closes the connections still waiting for a thread, and stops reading the requests of the ones being
+    // handled, which are closed once their current request is answered.
+    void stop()
+    {
+        std::scoped_lock lock(m_mutex);
+        m_stopped = true;
+        for (const auto fd : m_pending) {
+            ::close(fd);
+        }
+        m_pending.clear();
+        for (const auto fd : m_active) {
+            ::shutdown(fd, SHUT_RD);
+        }
+        m_ready.notify_all();
+    }
+
+private:
+    std::mutex m_mutex;
+    std::condition_variable m_ready;
+    std::deque<int> m_pending;
+    std::set<int> m_active;
+    std::size_t m_idle_threads;
+    bool m_stopped = false;
+};
+
+static void run_connection_thread(ConnectionQueue &queue, const ServerOptions &options, ServerStats &stats)
+{
+    for (int fd = queue.next(); fd >= 0; fd = queue.next()) {
+        // A failing connection is only closed, without taking the others down with it.
+        try {
+            handle_connection(fd, options, stats);
+        } catch (const std::exception &) {
+        }
+        queue.done(fd);
+    }
+}
+
+void serve(const std::string &socket_path, const ServerOptions &options, std::stop_token stop)
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+        throw std::invalid_argument("The socket path \"" + socket_path + "\" is too long");
+    }
+    std::strcpy(address.sun_path, socket_path.c_str());
+
+    const int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        throw std::system_error(errno, std::generic_category(), "Could not create the socket");
+    }
+    // A socket left behind by a previous server would make the bind fail, but anything else at the path
+    // is not the server's to remove.
+    struct stat status;
+    if (::lstat(socket_path.c_str(), &status) == 0) {
+        if (!S_ISSOCK(status.st_mode)) {
+            ::close(listener);
+            throw std::system_error(EEXIST, std::generic_category(), "Could not listen on \"" + socket_path + "\", which is not a socket");
+        }
+        ::unlink(socket_path.c_str());
+    }
+    if (::bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0 || ::listen(listener, SOMAXCONN) < 0) {
+        const auto error = errno;
+        ::close(listener);
+        throw std::system_error(error, std::generic_category(), "Could not listen on \"" + socket_path + "\"");
+    }
+
+    // Wakes the accepting loop up once a stop is requested.
+    int wake_pipe[2];
+    if (::pipe(wake_pipe) < 0) {
+        const auto error = errno;
+        ::close(listener);
+        throw std::system_error(error, std::generic_category(), "Could not create the socket");
+    }
+
+    int error = 0;
+    {
+        std::stop_callback wake(stop, [&wake_pipe] {
+            const char byte = 0;
+            [[maybe_unused]] const auto count = ::write(wake_pipe[1], &byte, 1);
+        });
+
+        // Declared before the threads, so they outlive them.
+        ServerStats stats;
+        const auto thread_count = std::max<std::size_t>(options.max_connections, 1);
+        ConnectionQueue queue(thread_count);
+        std::vector<std::jthread> threads;
+        try {
+            for (std::size_t i = 0; i < thread_count; i++) {
+                threads.emplace_back(run_connection_thread, std::ref(queue), std::cref(options), std::ref(stats));
+            }
+        } catch (const std::system_error &thread_error) {
+            error = thread_error.code().value();
+        }
+
+        std::array<pollfd, 2> polled{pollfd{listener, POLLIN, 0}, pollfd{wake_pipe[0], POLLIN, 0}};
+        while (error == 0 && !stop.stop_requested()) {
+            if (::poll(polled.data(), polled.size(), -1) < 0) {
+                if (errno != EINTR) {
+                    error = errno;
+                }
+                continue;
+            }
+            if (!(polled[0].revents & POLLIN)) {
+                continue;
+            }
+            const int fd = ::accept(listener, nullptr, nullptr);
+            if (fd < 0) {
+                if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                    // Running out of descriptors or memory passes once connections close, so the pending
+                    // connection is left to wait, after a pause that keeps the loop from spinning on it.
+                    stats.failed_accepts++;
+                    ::poll(&polled[1], 1, accept_retry_delay_ms);
+                } else if (errno != EINTR && errno != ECONNABORTED) {
+                    error = errno;
+                }
+                continue;
+            }
+            if (!queue.push(fd)) {
+                stats.refused_connections++;
+                send_all(fd, "{\"result\":\"error\",\"error\":\"Too many connections\"}\n");
+                ::close(fd);
+            }
+        }
+
+        queue.stop();
+    }
+
+    ::close(listener);
+    ::close(wake_pipe[0]);
+    ::close(wake_pipe[1]);
+    ::unlink(socket_path.c_str());
+    if (error != 0) {
+        throw std::system_error(error, std::generic_category(), "Could not serve on \"" + socket_path + "\"");
+    }
+}
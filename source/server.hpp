@@ -0,0 +1,43 @@
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include <string>
+#include <chrono>
+#include <cstddef>
+#include <stop_token>
+
+class ResultCache;
+
+struct ServerOptions
+{
+    // Limits on every single proof, 0 for none. A request can ask for a different time limit.
+    std::size_t memory_limit = 0;
+    std::chrono::milliseconds time_limit{};
+    // Adds the statistics of every proof to its result.
+    bool stats = false;
+    // Shared by all the connections, if given.
+    ResultCache *cache = nullptr;
+    // Connections handled at once, each on its own thread. Any more are refused.
+    std::size_t max_connections = 64;
+    // A connection without a request for this long is closed, freeing its thread. 0 for none.
+    std::chrono::seconds idle_timeout{300};
+};
+
+// Serves proofs on a Unix domain socket at the given path until a stop is requested, handling every
+// connection on one of a fixed number of threads. The result cache stays warm between the requests, while
+// the identifiers of a request are interned in the symbol table of its proof, and freed with it, so the
+// shared symbol table doesn't grow with the requests. The protocol is a line per request and a line of JSON per response:
+//
+//   prove <formula>                        the result of the proof, as in batch mode
+//   prove_within <milliseconds> <formula>  the same, with its own time limit
+//   stats                                  the counts and times of the requests served so far
+//
+// A connection that sends nothing for the idle timeout is closed. A connection that can't be accepted for
+// lack of descriptors or memory is left to the client to retry, and counted, without stopping the server.
+// Once a stop is requested, no more connections are accepted, the open ones are closed after answering
+// their current request, and the socket is removed. A socket left at the path by a previous server is
+// replaced. Throws std::system_error if the socket can't be set up, or if anything other than a socket is
+// at the path.
+void serve(const std::string &socket_path, const ServerOptions &options, std::stop_token stop = {});
+
+#endif // SERVER_HPP
@@ -0,0 +1,95 @@
+#include "symbol_table.hpp"
+
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <shared_mutex>
+#include <optional>
+
+// Shared by all the threads, so every access goes through the mutex.
+struct SymbolTable
+{
+    std::shared_mutex mutex;
+    // The names never move once interned, so the lookup table can key on views of them.
+    std::deque<std::string> names;
+    std::unordered_map<std::string_view, SymbolId> ids;
+};
+
+static SymbolTable &symbol_table()
+{
+    static SymbolTable table;
+    return table;
+}
+
+static std::optional<SymbolId> find_symbol(std::string_view symbol)
+{
+    auto &table = symbol_table();
+    std::shared_lock lock(table.mutex);
+    if (const auto it = table.ids.find(symbol); it != table.ids.end()) {
+        return it->second;
+    }
+    return std::nullopt;
+}
+
+SymbolId intern_symbol(std::string_view symbol)
+{
+    auto &table = symbol_table();
+    {
+        std::shared_lock lock(table.mutex);
+        if (const auto it = table.ids.find(symbol); it != table.ids.end()) {
+            return it->second;
+        }
+    }
+
+    std::unique_lock lock(table.mutex);
+    // Another thread might have interned the symbol in the meantime.
+    if (const auto it = table.ids.find(symbol); it != table.ids.end()) {
+        return it->second;
+    }
+    const auto id = static_cast<SymbolId>(table.names.size());
+    table.ids.emplace(table.names.emplace_back(symbol), id);
+    return id;
+}
+
+const std::string &symbol_name(SymbolId id)
+{
+    if (id & LocalSymbolTable::local_bit) {
+        return active_local_symbols->name(id);
+    }
+    auto &table = symbol_table();
+    std::shared_lock lock(table.mutex);
+    // The name itself never moves, so it can be used after the lock is released.
+    return table.names[id];
+}
+
+std::size_t symbol_count()
+{
+    auto &table = symbol_table();
+    std::shared_lock lock(table.mutex);
+    return table.names.size();
+}
+
+SymbolId LocalSymbolTable::intern(std::string_view symbol)
+{
+    // Looked up locally first, so a symbol keeps its id even if another thread interns it in the shared
+    // table in the meantime.
+    if (const auto it = m_ids.find(symbol); it != m_ids.end()) {
+        return it->second;
+    }
+    if (const auto id = find_symbol(symbol)) {
+        return *id;
+    }
+    const auto id = static_cast<SymbolId>(m_names.size()) | local_bit;
+    m_ids.emplace(m_names.emplace_back(symbol), id);
+    return id;
+}
+
+const std::string &LocalSymbolTable::name(SymbolId id) const
+{
+    return m_names[id & ~local_bit];
+}
+
+SymbolId intern_local_symbol(std::string_view symbol)
+{
+    return active_local_symbols != nullptr ? active_local_symbols->intern(symbol) : intern_symbol(symbol);
+}
@@ -0,0 +1,52 @@
+#ifndef SYMBOL_TABLE_HPP
+#define SYMBOL_TABLE_HPP
+
+#include <string>
+#include <string_view>
+#include <deque>
+#include <unordered_map>
+#include <cstddef>
+#include <cstdint>
+
+// Identifier of an interned variable symbol. A symbol interned in the shared table keeps its id for the
+// rest of the run. The shared table is used by all threads, and safe to use from any of them.
+using SymbolId = std::uint32_t;
+
+// Returns the id of the symbol, interning it if it was never seen before.
+SymbolId intern_symbol(std::string_view symbol);
+
+// Returns the symbol with the given id.
+const std::string &symbol_name(SymbolId id);
+
+// Returns the number of interned symbols, all of whose ids are smaller than it.
+std::size_t symbol_count();
+
+// Symbols of a single proof - the identifiers of its formula and the fresh names of renamed variables -
+// which would otherwise pile up in the shared table over a long running server. Their ids have the top
+// bit set, and are only meaningful while the table is the active one.
+class LocalSymbolTable
+{
+public:
+    static constexpr SymbolId local_bit = SymbolId(1) << 31;
+
+    // Returns the id of the symbol, which is the shared one if the symbol was interned there.
+    SymbolId intern(std::string_view symbol);
+    const std::string &name(SymbolId id) const;
+
+    LocalSymbolTable() = default;
+    LocalSymbolTable(const LocalSymbolTable &) = delete;
+    LocalSymbolTable &operator=(const LocalSymbolTable &) = delete;
+
+private:
+    // The names never move once interned, so the lookup table can key on views of them.
+    std::deque<std::string> m_names;
+    std::unordered_map<std::string_view, SymbolId> m_ids;
+};
+
+// The local symbols of the proof running on this thread.
+inline thread_local LocalSymbolTable *active_local_symbols = nullptr;
+
+// Returns the id of the symbol, interning it in the active local table if it was never seen before.
+SymbolId intern_local_symbol(std::string_view symbol);
+
+#endif // SYMBOL_TABLE_HPP
@@ -2,359 +2,587 @@
 #include "fourier_motzkin.hpp"
 #include "fol_string_conversion.hpp"
 #include "fol_normalization.hpp"
+#include "trace.hpp"
+#include "deadline.hpp"
+#include "result_cache.hpp"
+#include "quantifier_free.hpp"
 
 #include <stdexcept>
 #include <cassert>
 #include <iomanip>
+#include <algorithm>
+#include <iterator>
+#include <span>
+#include <chrono>
+#include <optional>
+#include <bit>
+#include <unordered_map>
 
-TheoremProver::TheoremProver(std::ostream &log)
-    : m_log(log)
+TheoremProver::TheoremProver(bool bound_pruning, std::size_t memory_limit, std::chrono::milliseconds time_limit, ResultCache *cache)
+    : m_bound_pruning(bound_pruning)
+    , m_memory_limit(memory_limit)
+    , m_time_limit(time_limit)
+    , m_cache(cache)
+{
+
+}
+
+TheoremProver::TheoremProver(std::ostream &log, LogLevel log_level, bool bound_pruning, std::size_t memory_limit, std::chrono::milliseconds time_limit, ResultCache *cache)
+    : m_log(log, log_level)
+    , m_bound_pruning(bound_pruning)
+    , m_memory_limit(memory_limit)
+    , m_time_limit(time_limit)
+    , m_cache(cache)
 {
 
 }
 
-static bool evaluate(const std::shared_ptr<Formula> formula);
 
-bool TheoremProver::is_theorem(const std::string &fol_formula) const
+// Adds the time from its construction to the end of its scope to a phase of the proof, if the
+// statistics of the proof are collected.
+class PhaseTimer
 {
-    auto formula = string_to_formula(fol_formula);
+public:
+    PhaseTimer(ProofStats *stats, std::chrono::nanoseconds PhaseTimes::*phase)
+        : m_phase(stats ? &(stats->times.*phase) : nullptr)
+        , m_start(m_phase ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{})
+    {
+
+    }
+
+    ~PhaseTimer()
+    {
+        if (m_phase) {
+            *m_phase += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start);
+        }
+    }
+
+private:
+    std::chrono::nanoseconds *m_phase;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+static FormulaRef parse(const std::string &fol_formula)
+{
+    const auto formula = string_to_formula(fol_formula);
     if (!formula) {
         throw std::invalid_argument("Parsing failed: \"" + fol_formula + "\" is not a valid first order logic formula");
     }
-    m_log << "========== [PROOF START] ==========" << std::endl;
-    m_log << "[FORMULA] " << formula_to_string(formula) << std::endl;
-    formula = close(pnf(formula));
-    m_log << "[CLOSED PRENEX] " << formula_to_string(formula) << std::endl;
-    VariableMapping var_map;
-    formula = eliminate_quantifiers(formula, var_map);
-    m_log << "[QUANTIFIER FREE FORM] " << formula_to_string(formula) << std::endl;
-    bool result = evaluate(formula);
-    m_log << "[RESULT] " << (result ? "Formula is a theorem" : "Formula is not a theorem") << std::endl;
-    m_log << "=========== [PROOF END] ===========" << std::endl;
+    return formula;
+}
+
+bool TheoremProver::is_theorem(const std::string &fol_formula, ProofStats *stats) const
+{
+    // Everything the proof allocates is charged to this account, so it has to outlive all of it.
+    MemoryAccount memory(m_memory_limit);
+    MemoryAccountScope memory_scope(memory);
+    DeadlineScope deadline_scope(m_time_limit);
+    // All the nodes of the proof live in this arena and are freed together at its end.
+    FormulaArena arena;
+    ArenaScope arena_scope(arena);
+
+    if (stats) {
+        *stats = ProofStats{};
+    }
+    FormulaRef formula;
+    {
+        PhaseTimer timer(stats, &PhaseTimes::parse);
+        formula = parse(fol_formula);
+    }
+    m_log(LogLevel::SUMMARY, [&](std::ostream &out) { out << "========== [PROOF START] =========="; });
+    m_log(LogLevel::SUMMARY, [&](std::ostream &out) { out << "[FORMULA] " << formula; });
+    {
+        PhaseTimer timer(stats, &PhaseTimes::normalization);
+        formula = miniscope(close(formula));
+        m_log(LogLevel::SUMMARY, [&](std::ostream &out) { out << "[CLOSED MINISCOPED] " << formula; });
+    }
+    // Formulas are looked up by their closed miniscoped form, in which the quantifiers keep their
+    // place regardless of the order of the operands around them.
+    const auto key = m_cache ? std::optional(cache_key(formula)) : std::nullopt;
+    const auto cached = key ? m_cache->lookup(*key) : std::nullopt;
+    bool result;
+    if (cached) {
+        result = *cached;
+        m_log(LogLevel::SUMMARY, [&](std::ostream &out) { out << "[CACHED RESULT]"; });
+        if (stats) {
+            stats->cache_hit = true;
+        }
+    } else {
+        result = decide(formula, stats);
+        if (key) {
+            m_cache->insert(*key, result);
+        }
+    }
+    m_log(LogLevel::SUMMARY, [&](std::ostream &out) { out << "[RESULT] " << (result ? "Formula is a theorem" : "Formula is not a theorem"); });
+    m_log(LogLevel::SUMMARY, [&](std::ostream &out) { out << "=========== [PROOF END] ==========="; });
+    if (stats) {
+        stats->memory = memory.usage();
+    }
     return result;
 }
 
-void VariableMapping::add_variable(const std::string &variable_symbol)
+bool TheoremProver::decide(FormulaRef formula, ProofStats *stats) const
+{
+    {
+        PhaseTimer timer(stats, &PhaseTimes::normalization);
+        formula = substitute_equalities(formula);
+        m_log(LogLevel::SUMMARY, [&](std::ostream &out) { out << "[EQUALITIES SUBSTITUTED] " << formula; });
+    }
+    VariableMapping var_map;
+    formula = eliminate_quantifiers(formula, var_map, stats);
+    m_log(LogLevel::SUMMARY, [&](std::ostream &out) { out << "[QUANTIFIER FREE FORM] " << formula; });
+    PhaseTimer timer(stats, &PhaseTimes::evaluation);
+    return evaluate(formula);
+}
+
+std::string TheoremProver::project(const std::string &fol_formula, const std::vector<std::string> &variables) const
 {
-    if (!m_symbol_to_number.contains(variable_symbol)) {
-        const auto variable_number = size();
-        m_number_to_symbol.insert({variable_number, variable_symbol});
-        m_symbol_to_number.insert({variable_symbol, variable_number});
+    MemoryAccount memory(m_memory_limit);
+    MemoryAccountScope memory_scope(memory);
+    DeadlineScope deadline_scope(m_time_limit);
+    FormulaArena arena;
+    ArenaScope arena_scope(arena);
+
+    auto formula = parse(fol_formula);
+    m_log(LogLevel::SUMMARY, [&](std::ostream &out) { out << "[PROJECTED FORMULA] " << formula; });
+    for (auto it = variables.crbegin(); it != variables.crend(); it++) {
+        formula = f_ptr<ExistentialQuantification>(intern_local_symbol(*it), formula);
+    }
+    formula = substitute_equalities(miniscope(formula));
+    // The free variables stay in scope through the whole elimination.
+    VariableMapping var_map;
+    for (const auto variable : free_variables(formula)) {
+        var_map.add_variable(variable);
     }
+    formula = simplify(eliminate_quantifiers(formula, var_map, nullptr));
+    m_log(LogLevel::SUMMARY, [&](std::ostream &out) { out << "[PROJECTION] " << formula; });
+    return formula_to_string(formula);
 }
 
-void VariableMapping::remove_variable(const std::string &variable_symbol)
+void VariableMapping::add_variable(SymbolId variable_symbol)
 {
-    assert(m_symbol_to_number.contains(variable_symbol));
-    const auto variable_number = get_variable_number(variable_symbol);
-    m_symbol_to_number.erase(variable_symbol);
-    m_number_to_symbol.erase(variable_number);
+    const auto it = m_symbol_to_number.try_emplace(variable_symbol, no_number).first;
+    m_shadowed_number.push_back(it->second);
+    it->second = m_number_to_symbol.size();
+    m_number_to_symbol.push_back(variable_symbol);
 }
 
-std::size_t VariableMapping::get_variable_number(const std::string &variable_symbol) const
+void VariableMapping::remove_variable(SymbolId variable_symbol)
 {
-    assert(m_symbol_to_number.contains(variable_symbol));
-    return m_symbol_to_number.find(variable_symbol)->second;
+    const auto it = m_symbol_to_number.find(variable_symbol);
+    assert(it != m_symbol_to_number.end() && it->second == size() - 1);
+    if (m_shadowed_number.back() != no_number) {
+        it->second = m_shadowed_number.back();
+    } else {
+        m_symbol_to_number.erase(it);
+    }
+    m_shadowed_number.pop_back();
+    m_number_to_symbol.pop_back();
 }
 
-std::string VariableMapping::get_variable_symbol(std::size_t variable_number) const
+std::size_t VariableMapping::get_variable_number(SymbolId variable_symbol) const
 {
-    assert(m_number_to_symbol.contains(variable_number));
-    return m_number_to_symbol.find(variable_number)->second;
+    const auto it = m_symbol_to_number.find(variable_symbol);
+    assert(it != m_symbol_to_number.end());
+    return it->second;
+}
+
+SymbolId VariableMapping::get_variable_symbol(std::size_t variable_number) const
+{
+    assert(variable_number < size());
+    return m_number_to_symbol[variable_number];
 }
 
 std::size_t VariableMapping::size() const
 {
-    return m_symbol_to_number.size();
+    return m_number_to_symbol.size();
 }
 
-static std::shared_ptr<Formula> simplify_constraints(std::shared_ptr<Atom> atom)
+// Writes the cubes as the DNF they make up.
+static void write_cubes(std::ostream &out, const Cubes &cubes)
 {
-    return std::visit(
-        overloaded{
-            [&atom](const EqualTo &node) {
-                return f_ptr<AtomWrapper>(atom);
-            },
-            [&atom](const LessThan &node) {
-                return f_ptr<AtomWrapper>(atom);
-            },
-            [](const LessOrEqualTo &node) {
-                return f_ptr<Disjunction>(
-                    f_ptr<AtomWrapper>(a_ptr<LessThan>(node.left, node.right)),
-                    f_ptr<AtomWrapper>(a_ptr<EqualTo>(node.left, node.right))
-                );
-            },
-            [&atom](const GreaterThan &node) {
-                return f_ptr<AtomWrapper>(atom);
-            },
-            [](const GreaterOrEqualTo &node) {
-                return f_ptr<Disjunction>(
-                    f_ptr<AtomWrapper>(a_ptr<GreaterThan>(node.left, node.right)),
-                    f_ptr<AtomWrapper>(a_ptr<EqualTo>(node.left, node.right))
-                );
-            },
-            [](const NotEqualTo &node) {
-                return f_ptr<Disjunction>(
-                    f_ptr<AtomWrapper>(a_ptr<LessThan>(node.left, node.right)),
-                    f_ptr<AtomWrapper>(a_ptr<LessThan>(node.right, node.left))
-                );
-            }
-        }, *atom
-    );
+    if (cubes.empty()) {
+        out << "F";
+        return;
+    } else if (std::any_of(cubes.cbegin(), cubes.cend(), [](const Cube &cube) { return cube.empty(); })) {
+        out << "T";
+        return;
+    }
+
+    for (std::size_t i = 0; i < cubes.size(); i++) {
+        for (std::size_t j = 0; j < cubes[i].size(); j++) {
+            out << (j > 0 ? " & " : (i > 0 ? " | " : "")) << f_ptr<AtomWrapper>(cubes[i][j]);
+        }
+    }
 }
 
-static std::shared_ptr<Formula> simplify_negated_constraints(std::shared_ptr<Atom> atom)
+static std::vector<ConstraintConjuction<Fraction>> cubes_to_constraints(const Cubes &cubes, const VariableMapping &var_map);
+
+static void normalize_constraints(std::vector<ConstraintConjuction<Fraction>> &constraints, bool bound_pruning)
 {
-    return std::visit(
-        overloaded{
-            [](const EqualTo &node) {
-                return simplify_constraints(a_ptr<NotEqualTo>(node.left, node.right));
-            },
-            [](const LessThan &node) {
-                return simplify_constraints(a_ptr<GreaterOrEqualTo>(node.left, node.right));
-            },
-            [](const LessOrEqualTo &node) {
-                return f_ptr<AtomWrapper>(a_ptr<GreaterThan>(node.left, node.right));
-            },
-            [](const GreaterThan &node) {
-                return simplify_constraints(a_ptr<LessOrEqualTo>(node.left, node.right));
-            },
-            [](const GreaterOrEqualTo &node) {
-                return f_ptr<AtomWrapper>(a_ptr<LessThan>(node.left, node.right));
-            },
-            [](const NotEqualTo &node) {
-                return f_ptr<AtomWrapper>(a_ptr<EqualTo>(node.left, node.right));
-            }
-        }, *atom
-    );
+    normalize_disjunction(constraints);
+    if (bound_pruning) {
+        std::erase_if(constraints, [](const ConstraintConjuction<Fraction> &conjuction) {
+            return conjuction.has_conflicting_bounds();
+        });
+    }
 }
 
-static std::shared_ptr<Formula> simplify_constraints(std::shared_ptr<Formula> formula)
+static FormulaRef constraints_to_formula(const std::vector<ConstraintConjuction<Fraction>> &constraints, const VariableMapping &var_map);
+
+// Collects the variables of a block of adjacent quantifiers of the same kind and returns the body of the block.
+template <typename QuantifierType>
+static FormulaRef collect_quantifier_block(FormulaRef formula, std::vector<SymbolId> &block)
 {
-    return std::visit(
-        overloaded{
-            [](const AtomWrapper &node) {
-                return simplify_constraints(node.atom);
-            },
-            [&formula](const True &node) {
-                return formula;
-            },
-            [&formula](const False &node) {
-                return formula;
-            },
-            [](const Negation &node) {
-                if (const auto *atom = std::get_if<AtomWrapper>(node.operand.get())) {
-                    return simplify_negated_constraints(atom->atom);
-                } else {
-                    return f_ptr<Negation>(simplify_constraints(node.operand));
-                }
-            },
-            [](const Conjuction &node) {
-                return f_ptr<Conjuction>(simplify_constraints(node.left), simplify_constraints(node.right));
-            },
-            [](const Disjunction &node) {
-                return f_ptr<Disjunction>(simplify_constraints(node.left), simplify_constraints(node.right));
-            },
-            [](const Implication &node) {
-                return f_ptr<Implication>(simplify_constraints(node.left), simplify_constraints(node.right));
-            },
-            [](const Equivalence &node) {
-                return f_ptr<Equivalence>(simplify_constraints(node.left), simplify_constraints(node.right));
-            },
-            [](const UniversalQuantification &node) {
-                return f_ptr<UniversalQuantification>(node.var_symbol, simplify_constraints(node.formula));
-            },
-            [](const ExistentialQuantification &node) {
-                return f_ptr<ExistentialQuantification>(node.var_symbol, simplify_constraints(node.formula));
-            }
-        }, *formula
-    );
+    while (const auto *quant = std::get_if<QuantifierType>(formula.get())) {
+        // An inner quantifier over the same variable shadows the outer one, so the outer one can be dropped.
+        if (std::find(block.cbegin(), block.cend(), quant->var_symbol) == block.cend()) {
+            block.push_back(quant->var_symbol);
+        }
+        formula = quant->formula;
+    }
+    return formula;
 }
 
-static std::vector<ConstraintConjuction<Fraction>> formula_to_constraints(std::shared_ptr<Formula> formula, const VariableMapping &var_map);
-static std::shared_ptr<Formula> constraints_to_formula(const std::vector<ConstraintConjuction<Fraction>> &constraints, const VariableMapping &var_map);
+// Replaces the results of the operands of the n-ary node, the last ones on the stack, with the node joining them.
+template <typename NaryType>
+static void join_operand_results(const NaryType &node, std::vector<FormulaRef> &results)
+{
+    const auto first = results.end() - static_cast<std::ptrdiff_t>(node.operands.size());
+    const std::vector<FormulaRef> operands(first, results.end());
+    results.erase(first, results.end());
+    results.push_back(f_ptr<NaryType>(operands));
+}
 
-std::shared_ptr<Formula> TheoremProver::eliminate_quantifiers(std::shared_ptr<Formula> formula, VariableMapping &var_map) const
+FormulaRef TheoremProver::eliminate_quantifiers(FormulaRef formula, VariableMapping &var_map, ProofStats *stats) const
 {
-    return std::visit(
-        overloaded{
-            [&formula](const AtomWrapper &node) {
-                return formula;
-            },
-            [&formula](const True &node) {
-                return formula;
-            },
-            [&formula](const False &node) {
-                return formula;
-            },
-            [&formula](const Negation &node) {
-                return formula;
-            },
-            [&formula](const Conjuction &node) {
-                return formula;
-            },
-            [&formula](const Disjunction &node) {
-                return formula;
-            },
-            [this, &var_map](const UniversalQuantification &node) {
-                return eliminate_variable(node.formula, node.var_symbol, var_map, false);
-            },
-            [this, &var_map](const ExistentialQuantification &node) {
-                return eliminate_variable(node.formula, node.var_symbol, var_map, true);
-            },
-            [&formula](const auto &node) {
-                assert(!"Unreachable");
-                return formula;
-            }
-        }, *formula
-    );
+    // Every formula on the work stack is expanded into its operands (or the body of its quantifier block)
+    // first, and finished once their results are on the results stack, so the depth of the formula is never
+    // limited by the call stack. The variables of a block are mapped while its body is being eliminated.
+    struct Step
+    {
+        FormulaRef formula;
+        bool is_expanded;
+        std::vector<SymbolId> block;
+    };
+    std::vector<Step> stack{{formula, false, {}}};
+    std::vector<FormulaRef> results;
+
+    const auto expand_block = [&stack, &var_map]<typename QuantifierType>(const QuantifierType &node) {
+        std::vector<SymbolId> block;
+        const auto body = collect_quantifier_block<QuantifierType>(stack.back().formula, block);
+        for (const auto &var : block) {
+            var_map.add_variable(var);
+        }
+        stack.back().block = std::move(block);
+        stack.push_back({body, false, {}});
+    };
+
+    while (!stack.empty()) {
+        if (stack.back().is_expanded) {
+            const auto step = std::move(stack.back());
+            stack.pop_back();
+            std::visit(
+                overloaded{
+                    [&results](const Conjuction &node) {
+                        join_operand_results(node, results);
+                    },
+                    [&results](const Disjunction &node) {
+                        join_operand_results(node, results);
+                    },
+                    [this, &step, &results, &var_map, stats](const UniversalQuantification &node) {
+                        results.back() = eliminate_variables(results.back(), step.block, var_map, false, stats);
+                    },
+                    [this, &step, &results, &var_map, stats](const ExistentialQuantification &node) {
+                        results.back() = eliminate_variables(results.back(), step.block, var_map, true, stats);
+                    },
+                    [](const auto &node) {
+                        assert(!"Unreachable");
+                    }
+                }, *step.formula
+            );
+            continue;
+        }
+
+        stack.back().is_expanded = true;
+        const auto current = stack.back().formula;
+        std::visit(
+            overloaded{
+                [&stack](const Conjuction &node) {
+                    for (auto it = node.operands.rbegin(); it != node.operands.rend(); it++) {
+                        stack.push_back({*it, false, {}});
+                    }
+                },
+                [&stack](const Disjunction &node) {
+                    for (auto it = node.operands.rbegin(); it != node.operands.rend(); it++) {
+                        stack.push_back({*it, false, {}});
+                    }
+                },
+                [&expand_block](const UniversalQuantification &node) {
+                    expand_block(node);
+                },
+                [&expand_block](const ExistentialQuantification &node) {
+                    expand_block(node);
+                },
+                [&current, &stack, &results](const auto &node) {
+                    // Atoms, negated atoms, T and F are quantifier free already.
+                    results.push_back(current);
+                    stack.pop_back();
+                }
+            }, *current
+        );
+    }
+    return results.back();
 }
 
-std::shared_ptr<Formula> TheoremProver::eliminate_variable(std::shared_ptr<Formula> base_formula, const std::string &quantified_variable, VariableMapping &var_map, bool is_existential) const
+template <typename NaryType>
+static void collect_operands(FormulaRef formula, std::vector<FormulaRef> &operands)
 {
-    var_map.add_variable(quantified_variable);
-    base_formula = eliminate_quantifiers(base_formula, var_map);
-    m_log << "[VARIABLE ELIMINATION] Eliminating " << (is_existential ? "existentially" : "universally") << " bound variable " << "\"" << quantified_variable << "\"" << std::endl;
-    if (!is_existential) {
-        base_formula = f_ptr<Negation>(base_formula);
-    }
-    m_log << "\tBase formula" << (is_existential ? "" : " (negated due to universal quantification)") << ": " << formula_to_string(base_formula) << std::endl;
-    base_formula = dnf(simplify_constraints(nnf(base_formula)));
-    m_log << "\tBase formula DNF: " << formula_to_string(base_formula) << std::endl;
-    if (!std::holds_alternative<True>(*base_formula) && !std::holds_alternative<False>(*base_formula)) {
-        auto constraints = formula_to_constraints(base_formula, var_map);
-        for (auto &conjuction : constraints) {
-            conjuction.eliminate_variable(var_map.get_variable_number(quantified_variable));
+    if (const auto *node = std::get_if<NaryType>(formula.get())) {
+        operands.insert(operands.end(), node->operands.begin(), node->operands.end());
+    } else {
+        operands.push_back(formula);
+    }
+}
+
+FormulaRef TheoremProver::eliminate_variables(FormulaRef base_formula, const std::vector<SymbolId> &quantified_variables, VariableMapping &var_map, bool is_existential, ProofStats *stats) const
+{
+    TraceSpan span("eliminate_variables");
+    if (span.is_recording()) {
+        std::string detail;
+        for (const auto &var : quantified_variables) {
+            detail += (detail.empty() ? "" : ", ") + symbol_name(var);
         }
-        base_formula = constraints_to_formula(constraints, var_map);
-        var_map.remove_variable(quantified_variable);
+        span.set_detail(std::move(detail));
+    }
+
+    m_log(LogLevel::VARIABLES, [&](std::ostream &out) {
+        out << "[VARIABLE ELIMINATION] Eliminating " << (is_existential ? "existentially" : "universally") << " bound variable" << (quantified_variables.size() > 1 ? "s " : " ");
+        for (std::size_t i = 0; i < quantified_variables.size(); i++) {
+            out << (i > 0 ? ", " : "") << "\"" << symbol_name(quantified_variables[i]) << "\"";
+        }
+    });
+
+    if (is_existential) {
+        m_log(LogLevel::TRACE, [&](std::ostream &out) { out << "\tBase formula: " << base_formula; });
+        base_formula = project_variables(base_formula, false, quantified_variables, var_map, stats);
+        m_log(LogLevel::TRACE, [&](std::ostream &out) { out << "\tNew base formula: " << base_formula; });
+    } else {
+        // The universal quantifier can either be eliminated through the DNF of the negated formula,
+        // or directly through the CNF of the formula - pick the one with the smaller normal form.
+        const auto cnf_size = estimate_normal_form_size(base_formula, false, false);
+        const auto dnf_size = estimate_normal_form_size(base_formula, true, true);
+        if (cnf_size.literals <= dnf_size.literals) {
+            m_log(LogLevel::TRACE, [&](std::ostream &out) { out << "\tBase formula: " << base_formula; });
+            base_formula = eliminate_universal_variables(base_formula, quantified_variables, var_map, stats);
+            m_log(LogLevel::TRACE, [&](std::ostream &out) { out << "\tNew base formula: " << base_formula; });
+        } else {
+            m_log(LogLevel::TRACE, [&](std::ostream &out) { out << "\tBase formula (negated due to universal quantification): " << f_ptr<Negation>(base_formula); });
+            base_formula = f_ptr<Negation>(project_variables(base_formula, true, quantified_variables, var_map, stats));
+            m_log(LogLevel::TRACE, [&](std::ostream &out) { out << "\tNew base formula (negated due to universal quantification): " << base_formula; });
+        }
+    }
+
+    for (auto it = quantified_variables.crbegin(); it != quantified_variables.crend(); it++) {
+        var_map.remove_variable(*it);
     }
-    base_formula = is_existential ? base_formula : f_ptr<Negation>(base_formula);
-    m_log << "\tNew base formula" << (is_existential ? "" : " (negated due to universal quantification)") << ": " << formula_to_string(base_formula) << std::endl;
     return base_formula;
 }
 
-static void collect_coefficients(std::shared_ptr<Term> term, std::vector<Fraction> &lhs, Fraction &rhs, const VariableMapping &var_map, bool flip_sign)
+FormulaRef TheoremProver::eliminate_universal_variables(FormulaRef base_formula, const std::vector<SymbolId> &quantified_variables, const VariableMapping &var_map, ProofStats *stats) const
 {
-    std::visit(
-        overloaded{
-            [&rhs, flip_sign](const RationalNumber &node) {
-                rhs = flip_sign ? rhs + node.value : rhs - node.value;
-            },
-            [&lhs, &var_map, flip_sign](const Variable &node) {
-                const auto var_num = var_map.get_variable_number(node.symbol);
-                lhs[var_num] = flip_sign ? lhs[var_num] - node.coef : lhs[var_num] + node.coef;
-            },
-            [&lhs, &rhs, &var_map, flip_sign](const Addition &node) {
-                collect_coefficients(node.left, lhs, rhs, var_map, flip_sign);
-                collect_coefficients(node.right, lhs, rhs, var_map, flip_sign);
-            },
-            [&lhs, &rhs, &var_map, flip_sign](const Subtraction &node) {
-                collect_coefficients(node.left, lhs, rhs, var_map, flip_sign);
-                collect_coefficients(node.right, lhs, rhs, var_map, !flip_sign);
+    {
+        PhaseTimer timer(stats, &PhaseTimes::normal_form);
+        base_formula = cnf(base_formula);
+    }
+    m_log(LogLevel::TRACE, [&](std::ostream &out) { out << "\tBase formula CNF: " << base_formula; });
+
+    std::vector<FormulaRef> clauses;
+    collect_operands<Conjuction>(base_formula, clauses);
+    std::vector<FormulaRef> result;
+    for (const auto &clause : clauses) {
+        // The universal quantifier distributes over the conjuction, and within a clause only the literals
+        // containing the quantified variables stay in its scope: !x.(C(x) | R) <=> ~(?x.~C(x)) | R
+        std::vector<FormulaRef> literals;
+        collect_operands<Disjunction>(clause, literals);
+        std::vector<FormulaRef> negated_dependent, independent;
+        for (const auto &literal : literals) {
+            const auto literal_vars = free_variables(literal);
+            const auto is_dependent = std::any_of(quantified_variables.cbegin(), quantified_variables.cend(), [&literal_vars](SymbolId var) {
+                return literal_vars.contains(var);
+            });
+            if (is_dependent) {
+                negated_dependent.push_back(f_ptr<Negation>(literal));
+            } else {
+                independent.push_back(literal);
             }
-        }, *term
-    );
+        }
+
+        if (negated_dependent.empty()) {
+            result.push_back(f_ptr<Disjunction>(independent));
+            continue;
+        }
+        m_log(LogLevel::TRACE, [&](std::ostream &out) { out << "\tClause: " << clause; });
+        const auto projected = project_variables(f_ptr<Conjuction>(negated_dependent), false, quantified_variables, var_map, stats);
+        independent.insert(independent.begin(), f_ptr<Negation>(projected));
+        result.push_back(f_ptr<Disjunction>(independent));
+    }
+
+    return simplify(f_ptr<Conjuction>(result));
 }
 
-static Constraint<Fraction> atom_to_constraint(std::shared_ptr<Atom> atom, const VariableMapping &var_map)
+static std::size_t count_rows(const std::vector<ConstraintConjuction<Fraction>> &constraints)
 {
-    return std::visit(
-        overloaded{
-            [&var_map](const EqualTo &node) {
-                std::vector<Fraction> lhs(var_map.size());
-                Fraction rhs;
-                collect_coefficients(node.left, lhs, rhs, var_map, false);
-                collect_coefficients(node.right, lhs, rhs, var_map, true);
-                return Constraint<Fraction>(lhs, Constraint<Fraction>::Relation::EQ, rhs);
-            },
-            [&var_map](const LessThan &node) {
-                std::vector<Fraction> lhs(var_map.size());
-                Fraction rhs;
-                collect_coefficients(node.left, lhs, rhs, var_map, false);
-                collect_coefficients(node.right, lhs, rhs, var_map, true);
-                return Constraint<Fraction>(lhs, Constraint<Fraction>::Relation::LT, rhs);
-            },
-            [&var_map](const GreaterThan &node) {
-                std::vector<Fraction> lhs(var_map.size());
-                Fraction rhs;
-                collect_coefficients(node.left, lhs, rhs, var_map, false);
-                collect_coefficients(node.right, lhs, rhs, var_map, true);
-                return Constraint<Fraction>(lhs, Constraint<Fraction>::Relation::GT, rhs);
-            },
-            [](const auto &node) {
-                assert(!"Unreachable");
-                return Constraint<Fraction>({}, Constraint<Fraction>::Relation::EQ, Fraction{});
+    std::size_t rows = 0;
+    for (const auto &conjuction : constraints) {
+        rows += conjuction.get_constraints().size();
+    }
+    return rows;
+}
+
+static unsigned bit_length(const Fraction &value)
+{
+    static constexpr auto bits = [](int value) {
+        return static_cast<unsigned>(std::bit_width(value < 0 ? 0u - static_cast<unsigned>(value) : static_cast<unsigned>(value)));
+    };
+    return std::max(bits(value.get_numerator()), bits(value.get_denominator()));
+}
+
+static unsigned max_coefficient_bits(const std::vector<ConstraintConjuction<Fraction>> &constraints)
+{
+    unsigned max_bits = 0;
+    for (const auto &conjuction : constraints) {
+        for (const auto &constraint : conjuction.get_constraints()) {
+            for (const auto &coef : constraint.get_lhs()) {
+                max_bits = std::max(max_bits, bit_length(coef));
             }
-        }, *atom
-    );
+            max_bits = std::max(max_bits, bit_length(constraint.get_rhs()));
+        }
+    }
+    return max_bits;
 }
 
-static ConstraintConjuction<Fraction> conjuction_to_constraints(std::shared_ptr<Formula> formula, const VariableMapping &var_map)
+FormulaRef TheoremProver::project_variables(FormulaRef base_formula, bool negated, const std::vector<SymbolId> &quantified_variables, const VariableMapping &var_map, ProofStats *stats) const
 {
-    return std::visit(
-        overloaded{
-            [&var_map](const AtomWrapper &node) {
-                return ConstraintConjuction<Fraction>({atom_to_constraint(node.atom, var_map)});
-            },
-            [&var_map](const Conjuction &node) {
-                const auto left = conjuction_to_constraints(node.left, var_map).get_constraints();
-                const auto right = conjuction_to_constraints(node.right, var_map).get_constraints();
-                std::vector<Constraint<Fraction>> left_right_concat;
-                left_right_concat.reserve(left.size() + right.size());
-                left_right_concat.insert(left_right_concat.end(), left.begin(), left.end());
-                left_right_concat.insert(left_right_concat.end(), right.begin(), right.end());
-                return ConstraintConjuction<Fraction>(left_right_concat);
-            },
-            [](const auto &node) {
-                assert(!"Unreachable");
-                return ConstraintConjuction<Fraction>({});
+    Cubes cubes;
+    {
+        TraceSpan span("formula_to_cubes");
+        PhaseTimer timer(stats, &PhaseTimes::normal_form);
+        cubes = formula_to_cubes(base_formula, negated);
+    }
+    m_log(LogLevel::TRACE, [&](std::ostream &out) {
+        out << "\tBase formula DNF: ";
+        write_cubes(out, cubes);
+    });
+    if (cubes.empty()) {
+        return f_ptr<False>();
+    } else if (std::any_of(cubes.cbegin(), cubes.cend(), [](const Cube &cube) { return cube.empty(); })) {
+        return f_ptr<True>();
+    }
+
+    PhaseTimer timer(stats, &PhaseTimes::elimination);
+    auto constraints = cubes_to_constraints(cubes, var_map);
+    if (stats) {
+        stats->peak_live_rows = std::max(stats->peak_live_rows, count_rows(constraints));
+    }
+    normalize_constraints(constraints, m_bound_pruning);
+    auto remaining_variables = quantified_variables;
+    while (!remaining_variables.empty() && !constraints.empty()) {
+        // Eliminate the variable that grows the constraints the least first.
+        std::vector<std::ptrdiff_t> costs(remaining_variables.size());
+        for (std::size_t i = 0; i < remaining_variables.size(); i++) {
+            const auto var_num = var_map.get_variable_number(remaining_variables[i]);
+            for (const auto &conjuction : constraints) {
+                costs[i] += conjuction.elimination_cost(var_num);
             }
-        }, *formula
-    );
+        }
+        const auto cheapest = std::min_element(costs.cbegin(), costs.cend()) - costs.cbegin();
+        const auto var_num = var_map.get_variable_number(remaining_variables[cheapest]);
+        m_log(LogLevel::VARIABLES, [&](std::ostream &out) { out << "\tEliminating \"" << symbol_name(remaining_variables[cheapest]) << "\" from " << constraints.size() << " cube(s), estimated constraint growth: " << costs[cheapest]; });
+
+        auto *variable_stats = stats ? &stats->eliminations.emplace_back() : nullptr;
+        if (variable_stats) {
+            variable_stats->variable = symbol_name(remaining_variables[cheapest]);
+            variable_stats->cubes = constraints.size();
+            variable_stats->constraints_before = count_rows(constraints);
+        }
+        for (auto &conjuction : constraints) {
+            const auto step = conjuction.eliminate_variable(var_num);
+            if (variable_stats) {
+                variable_stats->eliminated_by_equality += step.by_equality;
+                variable_stats->lt_bounds += step.lt_bounds;
+                variable_stats->gt_bounds += step.gt_bounds;
+                variable_stats->rows_generated += step.generated_rows;
+            }
+        }
+        if (variable_stats) {
+            const auto live_rows = count_rows(constraints);
+            stats->peak_live_rows = std::max(stats->peak_live_rows, live_rows);
+            variable_stats->max_coefficient_bits = max_coefficient_bits(constraints);
+            normalize_constraints(constraints, m_bound_pruning);
+            variable_stats->constraints_after = count_rows(constraints);
+            variable_stats->rows_pruned = live_rows - variable_stats->constraints_after;
+        } else {
+            normalize_constraints(constraints, m_bound_pruning);
+        }
+        remaining_variables.erase(remaining_variables.begin() + cheapest);
+    }
+    return constraints_to_formula(constraints, var_map);
 }
 
-static std::vector<ConstraintConjuction<Fraction>> formula_to_constraints(std::shared_ptr<Formula> formula, const VariableMapping &var_map)
+static Constraint<Fraction> atom_to_constraint(AtomRef atom, const VariableMapping &var_map)
 {
+    // The atom is term REL 0, so the coefficients of the term make up the left hand side as they are.
+    static constexpr auto to_constraint = [](TermRef term, Constraint<Fraction>::Relation relation, const VariableMapping &var_map) {
+        Constraint<Fraction>::Coefficients lhs(var_map.size());
+        for (const auto &[symbol, coef] : term->coefs) {
+            lhs[var_map.get_variable_number(symbol)] = coef;
+        }
+        return Constraint<Fraction>(std::move(lhs), relation, -term->constant);
+    };
+
     return std::visit(
         overloaded{
-            [&formula, &var_map](const AtomWrapper &node) {
-                return std::vector<ConstraintConjuction<Fraction>>({conjuction_to_constraints(formula, var_map)});
+            [&var_map](const EqualTo &node) {
+                return to_constraint(node.term, Constraint<Fraction>::Relation::EQ, var_map);
             },
-            [&formula, &var_map](const Conjuction &node) {
-                return std::vector<ConstraintConjuction<Fraction>>({conjuction_to_constraints(formula, var_map)});
+            [&var_map](const LessThan &node) {
+                return to_constraint(node.term, Constraint<Fraction>::Relation::LT, var_map);
             },
-            [&var_map](const Disjunction &node) {
-                const auto left = formula_to_constraints(node.left, var_map);
-                const auto right = formula_to_constraints(node.right, var_map);
-                std::vector<ConstraintConjuction<Fraction>> left_right_concat;
-                left_right_concat.reserve(left.size() + right.size());
-                left_right_concat.insert(left_right_concat.end(), left.begin(), left.end());
-                left_right_concat.insert(left_right_concat.end(), right.begin(), right.end());
-                return left_right_concat;
+            [&var_map](const GreaterThan &node) {
+                return to_constraint(node.term, Constraint<Fraction>::Relation::GT, var_map);
             },
             [](const auto &node) {
                 assert(!"Unreachable");
-                return std::vector<ConstraintConjuction<Fraction>>();
+                return Constraint<Fraction>(Constraint<Fraction>::Coefficients{}, Constraint<Fraction>::Relation::EQ, Fraction{});
             }
-        }, *formula
+        }, *atom
     );
 }
 
-static std::shared_ptr<Formula> constraint_to_formula(const Constraint<Fraction> &constraint, const VariableMapping &var_map)
+static std::vector<ConstraintConjuction<Fraction>> cubes_to_constraints(const Cubes &cubes, const VariableMapping &var_map)
+{
+    std::vector<ConstraintConjuction<Fraction>> constraints;
+    constraints.reserve(cubes.size());
+    for (const auto &cube : cubes) {
+        std::vector<Constraint<Fraction>> conjuction;
+        conjuction.reserve(cube.size());
+        for (const auto &atom : cube) {
+            conjuction.push_back(atom_to_constraint(atom, var_map));
+        }
+        constraints.push_back(ConstraintConjuction<Fraction>(conjuction));
+    }
+    return constraints;
+}
+
+static FormulaRef constraint_to_formula(const Constraint<Fraction> &constraint, const VariableMapping &var_map)
 {
     const auto &lhs = constraint.get_lhs();
-    std::shared_ptr<Term> left = t_ptr<RationalNumber>(0);
+    LinearTerm left;
     for (std::size_t var_num = 0; var_num < lhs.size(); var_num++) {
-        const auto coef = lhs[var_num];
-        const auto var = var_map.get_variable_symbol(var_num);
-        if (coef > 0) {
-            left = t_ptr<Addition>(left, t_ptr<Variable>(coef, var));
-        } else if (coef < 0) {
-            left = t_ptr<Subtraction>(left, t_ptr<Variable>(-coef, var));
-        }
+        left = left + LinearTerm(lhs[var_num], var_map.get_variable_symbol(var_num));
     }
-    const auto right = t_ptr<RationalNumber>(constraint.get_rhs());
+    const auto right = LinearTerm(constraint.get_rhs());
     if (constraint.get_relation() == Constraint<Fraction>::Relation::LT) {
         return f_ptr<AtomWrapper>(a_ptr<LessThan>(left, right));
     } else if (constraint.get_relation() == Constraint<Fraction>::Relation::GT) {
@@ -364,116 +592,21 @@ static std::shared_ptr<Formula> constraint_to_formula(const Constraint<Fraction>
     }
 }
 
-static std::shared_ptr<Formula> conjuction_to_formula(const ConstraintConjuction<Fraction> &conjuction, const VariableMapping &var_map)
+static FormulaRef conjuction_to_formula(const ConstraintConjuction<Fraction> &conjuction, const VariableMapping &var_map)
 {
-    const auto &constraints = conjuction.get_constraints();
-    if (constraints.size() == 0) {
-        return f_ptr<True>();
-    } else {
-        auto acc = constraint_to_formula(constraints[0], var_map);
-        for (std::size_t i = 1; i < constraints.size(); i++) {
-            acc = f_ptr<Conjuction>(acc, constraint_to_formula(constraints[i], var_map));
-        }
-        return acc;
+    std::vector<FormulaRef> literals;
+    for (const auto &constraint : conjuction.get_constraints()) {
+        literals.push_back(constraint_to_formula(constraint, var_map));
     }
+    return f_ptr<Conjuction>(literals);
 }
 
-static std::shared_ptr<Formula> constraints_to_formula(const std::vector<ConstraintConjuction<Fraction>> &constraints, const VariableMapping &var_map)
+static FormulaRef constraints_to_formula(const std::vector<ConstraintConjuction<Fraction>> &constraints, const VariableMapping &var_map)
 {
-    if (constraints.size() == 0) {
-        return f_ptr<False>();
-    } else {
-        auto acc = conjuction_to_formula(constraints[0], var_map);
-        for (std::size_t i = 1; i < constraints.size(); i++) {
-            acc = f_ptr<Disjunction>(acc, conjuction_to_formula(constraints[i], var_map));
-        }
-        return acc;
+    std::vector<FormulaRef> cubes;
+    for (const auto &conjuction : constraints) {
+        cubes.push_back(conjuction_to_formula(conjuction, var_map));
     }
+    return f_ptr<Disjunction>(cubes);
 }
 
-static Fraction evaluate(const std::shared_ptr<Term> term)
-{
-    return std::visit(
-        overloaded{
-            [](const RationalNumber &node) {
-                return node.value;
-            },
-            [](const Addition &node) {
-                return evaluate(node.left) + evaluate(node.right);
-            },
-            [](const Subtraction &node) {
-                return evaluate(node.left) - evaluate(node.right);
-            },
-            [](const auto &node) {
-                assert(!"Unreachable");
-                return Fraction{};
-            }
-        }, *term
-    );
-}
-
-static bool evaluate(const std::shared_ptr<Atom> atom)
-{
-    return std::visit(
-        overloaded{
-            [](const EqualTo &node) {
-                return evaluate(node.left) == evaluate(node.right);
-            },
-            [](const LessThan &node) {
-                return evaluate(node.left) < evaluate(node.right);
-            },
-            [](const LessOrEqualTo &node) {
-                return evaluate(node.left) <= evaluate(node.right);
-            },
-            [](const GreaterThan &node) {
-                return evaluate(node.left) > evaluate(node.right);
-            },
-            [](const GreaterOrEqualTo &node) {
-                return evaluate(node.left) >= evaluate(node.right);
-            },
-            [](const NotEqualTo &node) {
-                return evaluate(node.left) != evaluate(node.right);
-            }
-        }, *atom
-    );
-}
-
-static bool evaluate(const std::shared_ptr<Formula> formula)
-{
-    return std::visit(
-        overloaded{
-            [](const AtomWrapper &node) {
-                return evaluate(node.atom);
-            },
-            [](const True &node) {
-                return true;
-            },
-            [](const False &node) {
-                return false;
-            },
-            [](const Negation &node) {
-                return !evaluate(node.operand);
-            },
-            [](const Conjuction &node) {
-                return evaluate(node.left) && evaluate(node.right);
-            },
-            [](const Disjunction &node) {
-                return evaluate(node.left) || evaluate(node.right);
-            },
-            [](const Implication &node) {
-                if (evaluate(node.left)) {
-                    return evaluate(node.right);
-                } else {
-                    return true;
-                }
-            },
-            [](const Equivalence &node) {
-                return evaluate(node.left) == evaluate(node.right);
-            },
-            [](const auto &node) {
-                assert(!"Unreachable");
-                return false;
-            }
-        }, *formula
-    );
-}
@@ -2,45 +2,85 @@
 #define THEOREM_PROVER_HPP
 
 #include "fol_ast.hpp"
+#include "proof_log.hpp"
+#include "proof_stats.hpp"
 
 #include <string>
-#include <memory>
 #include <ostream>
-#include <map>
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
 
+// Numbers the variables in scope densely, in the order they were added, for the constraints to be indexed by.
+// The variables are removed in the reverse order. A variable added again, by a quantifier nested in one
+// binding the same symbol, shadows the outer one until it is removed.
 class VariableMapping
 {
 public:
-    void add_variable(const std::string &variable_symbol);
-    void remove_variable(const std::string &variable_symbol);
+    void add_variable(SymbolId variable_symbol);
+    void remove_variable(SymbolId variable_symbol);
 
-    std::size_t get_variable_number(const std::string &variable_symbol) const;
-    std::string get_variable_symbol(std::size_t variable_number) const;
+    std::size_t get_variable_number(SymbolId variable_symbol) const;
+    SymbolId get_variable_symbol(std::size_t variable_number) const;
 
     std::size_t size() const;
 
 private:
-    std::map<std::string, std::size_t> m_symbol_to_number;
-    std::map<std::size_t, std::string> m_number_to_symbol;
+    static constexpr std::size_t no_number = SIZE_MAX;
+
+    // Only holds the symbols in scope, so it costs no more than the proof's own variables.
+    std::unordered_map<SymbolId, std::size_t> m_symbol_to_number;
+    std::vector<SymbolId> m_number_to_symbol;
+    // Number the symbol of each number had before it was added, if it was shadowed.
+    std::vector<std::size_t> m_shadowed_number;
 };
 
-namespace
-{
-std::ostream null_stream = std::ostream(nullptr);
-}
+class ResultCache;
 
+// Separate instances share no mutable state but their result cache, which is safe to share, so they
+// can prove formulas in parallel threads, as long as they log to separate streams. A single instance
+// must not be used by several threads at once.
 class TheoremProver
 {
 public:
-    TheoremProver(std::ostream &log = null_stream);
+    // With bound_pruning enabled, cubes whose single variable constraints already impose
+    // conflicting bounds are discarded after every elimination round. With a memory limit (in
+    // bytes, 0 for none), a proof whose formulas, cubes and constraints would take more than
+    // that is aborted by throwing MemoryLimitExceeded. With a time limit (0 for none), a proof
+    // that takes longer than that is aborted by throwing TimeLimitExceeded. With a result cache,
+    // which has to outlive the prover, formulas are looked up in it before they are proved and their
+    // results are stored in it after.
+    explicit TheoremProver(bool bound_pruning = true, std::size_t memory_limit = 0, std::chrono::milliseconds time_limit = {}, ResultCache *cache = nullptr);
+    // Logs the steps of the proofs to the given stream, in as much detail as the level asks for.
+    explicit TheoremProver(std::ostream &log, LogLevel log_level = LogLevel::TRACE, bool bound_pruning = true, std::size_t memory_limit = 0, std::chrono::milliseconds time_limit = {}, ResultCache *cache = nullptr);
 
-    bool is_theorem(const std::string &fol_formula) const;
+    // Fills in the statistics of the proof, if given a place for them.
+    bool is_theorem(const std::string &fol_formula, ProofStats *stats = nullptr) const;
+    // Returns a quantifier free formula over the remaining free variables, equivalent to the given
+    // one with the given variables existentially quantified. Limited like a proof.
+    std::string project(const std::string &fol_formula, const std::vector<std::string> &variables) const;
 
 private:
-    std::ostream &m_log;
+    ProofLog m_log;
+    bool m_bound_pruning;
+    std::size_t m_memory_limit;
+    std::chrono::milliseconds m_time_limit;
+    ResultCache *m_cache;
+
+    // Decides the closed miniscoped formula.
+    bool decide(FormulaRef formula, ProofStats *stats) const;
 
-    std::shared_ptr<Formula> eliminate_quantifiers(std::shared_ptr<Formula> formula, VariableMapping &var_map) const;
-    std::shared_ptr<Formula> eliminate_variable(std::shared_ptr<Formula> base_formula, const std::string &quantified_variable, VariableMapping &var_map, bool is_existential) const;
+    // Eliminates the quantifiers of a miniscoped formula bottom-up, so that every quantifier
+    // block only ever sees the (quantifier free) subformula it scopes over.
+    FormulaRef eliminate_quantifiers(FormulaRef formula, VariableMapping &var_map, ProofStats *stats) const;
+    // Eliminates the variables of a quantifier block, already added to the mapping, from the block's body
+    // with its own quantifiers eliminated, and removes them from the mapping.
+    FormulaRef eliminate_variables(FormulaRef base_formula, const std::vector<SymbolId> &quantified_variables, VariableMapping &var_map, bool is_existential, ProofStats *stats) const;
+    // Eliminates universally quantified variables through the CNF of the formula, clause by clause.
+    FormulaRef eliminate_universal_variables(FormulaRef base_formula, const std::vector<SymbolId> &quantified_variables, const VariableMapping &var_map, ProofStats *stats) const;
+    // Eliminates existentially quantified variables from each cube of the DNF of the formula (or of its negation).
+    FormulaRef project_variables(FormulaRef base_formula, bool negated, const std::vector<SymbolId> &quantified_variables, const VariableMapping &var_map, ProofStats *stats) const;
 };
 
 #endif // THEOREM_PROVER_HPP
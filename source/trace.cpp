@@ -0,0 +1,141 @@
+#include "trace.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+struct TraceEvent
+{
+    const char *name;
+    std::string detail;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::duration duration;
+};
+
+// Every thread records into a buffer of its own, so the threads never wait on each other. The lock
+// of a buffer is only ever contended while the trace is written or restarted.
+struct ThreadBuffer
+{
+    std::mutex mutex;
+    std::uint32_t thread_id;
+    std::vector<TraceEvent> events;
+};
+
+// The buffers are owned by the trace rather than by their threads, so the spans of the threads that
+// already finished are still there to be written.
+struct Trace
+{
+    std::atomic<bool> enabled = false;
+    std::mutex mutex;
+    std::chrono::steady_clock::time_point origin;
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+};
+
+static Trace &trace()
+{
+    static Trace trace;
+    return trace;
+}
+
+static ThreadBuffer &thread_buffer()
+{
+    thread_local const auto buffer = [] {
+        auto &trace = ::trace();
+        std::lock_guard lock(trace.mutex);
+        auto buffer = std::make_shared<ThreadBuffer>();
+        buffer->thread_id = static_cast<std::uint32_t>(trace.buffers.size()) + 1;
+        trace.buffers.push_back(buffer);
+        return buffer;
+    }();
+    return *buffer;
+}
+
+void start_tracing()
+{
+    auto &trace = ::trace();
+    std::lock_guard lock(trace.mutex);
+    for (const auto &buffer : trace.buffers) {
+        std::lock_guard buffer_lock(buffer->mutex);
+        buffer->events.clear();
+    }
+    trace.origin = std::chrono::steady_clock::now();
+    trace.enabled.store(true, std::memory_order_relaxed);
+}
+
+void stop_tracing()
+{
+    trace().enabled.store(false, std::memory_order_relaxed);
+}
+
+bool is_tracing()
+{
+    return trace().enabled.load(std::memory_order_relaxed);
+}
+
+static void write_escaped(std::ostream &out, const std::string &text)
+{
+    for (const auto c : text) {
+        if (c == '"' || c == '\\') {
+            out << '\\';
+        }
+        out << c;
+    }
+}
+
+void write_trace(std::ostream &out)
+{
+    using microseconds = std::chrono::duration<double, std::micro>;
+
+    auto &trace = ::trace();
+    std::lock_guard lock(trace.mutex);
+    out << "{\"traceEvents\":[";
+    bool first = true;
+    for (const auto &buffer : trace.buffers) {
+        std::lock_guard buffer_lock(buffer->mutex);
+        for (const auto &event : buffer->events) {
+            out << (first ? "" : ",") << "\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->thread_id
+                << ",\"ts\":" << microseconds(event.start - trace.origin).count()
+                << ",\"dur\":" << microseconds(event.duration).count();
+            if (!event.detail.empty()) {
+                out << ",\"args\":{\"detail\":\"";
+                write_escaped(out, event.detail);
+                out << "\"}";
+            }
+            out << "}";
+            first = false;
+        }
+    }
+    out << "\n]}" << std::endl;
+}
+
+TraceSpan::TraceSpan(const char *name)
+    : m_name(name)
+    , m_recording(is_tracing())
+{
+    if (m_recording) {
+        m_start = std::chrono::steady_clock::now();
+    }
+}
+
+TraceSpan::~TraceSpan()
+{
+    if (!m_recording) {
+        return;
+    }
+    const auto duration = std::chrono::steady_clock::now() - m_start;
+    auto &buffer = thread_buffer();
+    std::lock_guard lock(buffer.mutex);
+    buffer.events.push_back(TraceEvent{m_name, std::move(m_detail), m_start, duration});
+}
+
+bool TraceSpan::is_recording() const
+{
+    return m_recording;
+}
+
+void TraceSpan::set_detail(std::string detail)
+{
+    m_detail = std::move(detail);
+}
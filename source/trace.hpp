@@ -0,0 +1,42 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <string>
+#include <chrono>
+#include <ostream>
+
+// Scoped spans over the phases of the proofs, recorded as a timeline in the Chrome trace event
+// format (which Perfetto reads as well). Recording is off by default, and a span then costs a
+// single relaxed load of the flag. The spans of every thread are kept apart and tagged with it.
+
+// Starts recording spans, dropping any recorded before.
+void start_tracing();
+// Stops recording spans - the ones already recorded are kept for writing.
+void stop_tracing();
+bool is_tracing();
+
+// Writes the recorded spans as a JSON trace. The spans still open are not written.
+void write_trace(std::ostream &out);
+
+class TraceSpan
+{
+public:
+    // The name must outlive the trace, as string literals do.
+    explicit TraceSpan(const char *name);
+    ~TraceSpan();
+
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+    bool is_recording() const;
+    // Attaches a detail to the span, shown along with it. Building it is only worth it while recording.
+    void set_detail(std::string detail);
+
+private:
+    const char *m_name;
+    bool m_recording;
+    std::chrono::steady_clock::time_point m_start;
+    std::string m_detail;
+};
+
+#endif // TRACE_HPP